@@ -0,0 +1,251 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: lfsr.h
+// REFERENCES: None, only provided materials used.
+
+#ifndef KEYSTREAMCACHE_H
+#define KEYSTREAMCACHE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "lfsr.h"
+
+/*******************/
+/**** Constants ****/
+const size_t KEYSTREAM_CACHE_DEFAULT_LENGTH = 1024 * 1024;	// Default longest keystream kept per initial value
+const size_t KEYSTREAM_CACHE_DEFAULT_BYTES = 64 * 1024 * 1024;	// Default most keystream bytes kept, across all initial values
+const size_t KEYSTREAM_CACHE_MIN_GROWTH = 4096;				// Smallest keystream generated when a cache entry grows
+
+/*******************/
+/***** Structs *****/
+struct KeystreamCacheStats {
+	uint64_t hits;			// Calls served entirely from already cached keystream
+	uint64_t misses;		// Calls that had to generate (or extend) cached keystream
+	uint64_t bytesServed;	// Bytes xor'd against cached keystream
+	uint64_t bytesCached;	// Keystream bytes currently held, across all initial values
+	uint64_t evictions;		// Keystreams dropped to keep bytesCached within the byte limit
+};
+
+/*******************/
+/***** Classes *****/
+// KeystreamCache: Thread-safe store of keystream bytes keyed by initial value.
+// Each initial value's keystream is generated once and grows lazily, up to maxLength bytes, when a
+// longer request arrives. Bytes past maxLength are generated on the fly from the jump-ahead key.
+// Keystreams are never changed once stored: growing one builds a longer copy outside the lock and swaps
+// it in, so a cold initial value never blocks calls on others. Once more than maxBytes are held, the
+// least recently used keystreams are dropped.
+class KeystreamCache {
+private:
+	struct Keystream {
+		std::vector<unsigned char> bytes;	// Keystream bytes, bytes[i] is applied to data offset i
+		unsigned int nextKey;				// Key for offset bytes.size(), for extending the keystream
+		std::atomic<uint64_t> lastUse;		// Call count when last used, for eviction
+	};
+	typedef std::shared_ptr<Keystream> KeystreamPtr;
+
+	mutable std::shared_mutex lock;	// Guards the map only, keystream bytes are read without it
+	std::unordered_map<unsigned int, KeystreamPtr> keystreams;
+	size_t maxLength;
+	size_t maxBytes;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> misses;
+	std::atomic<uint64_t> bytesServed;
+	std::atomic<uint64_t> bytesCached;
+	std::atomic<uint64_t> evictions;
+
+	// find(): Keystream stored for an initial value, or null if there is none.
+	KeystreamPtr find(unsigned int initialValue) const
+	{
+		std::shared_lock<std::shared_mutex> readLock(lock);
+		std::unordered_map<unsigned int, KeystreamPtr>::const_iterator found = keystreams.find(initialValue);
+		return (found != keystreams.end()) ? found->second : KeystreamPtr();
+	}
+
+	// grow(): New keystream holding an old one's bytes (if any), extended to at least length bytes.
+	// Runs without the lock.
+	KeystreamPtr grow(const KeystreamPtr &old, unsigned int initialValue, size_t length) const
+	{
+		size_t oldLength = (old) ? old->bytes.size() : 0;
+		size_t newLength = oldLength * 2;
+		if(newLength < length)
+		{
+			newLength = length;
+		}
+		if(newLength < KEYSTREAM_CACHE_MIN_GROWTH)
+		{
+			newLength = KEYSTREAM_CACHE_MIN_GROWTH;
+		}
+		if(newLength > maxLength)
+		{
+			newLength = maxLength;
+		}
+
+		KeystreamPtr grown = std::make_shared<Keystream>();
+		grown->bytes.resize(newLength);
+		if(oldLength > 0)
+		{
+			memcpy(grown->bytes.data(), old->bytes.data(), oldLength);
+		}
+		unsigned int key = (old) ? old->nextKey : getNewKey(initialValue);
+		grown->nextKey = generateKeystream(&grown->bytes[oldLength], newLength - oldLength, key);
+		grown->lastUse = 0;
+		return grown;
+	}
+
+	// store(): Stores a grown keystream, unless a keystream at least as long was stored meanwhile, then
+	// evicts past the byte limit.
+	// Return: KeystreamPtr; keystream now stored for the initial value.
+	KeystreamPtr store(unsigned int initialValue, const KeystreamPtr &grown)
+	{
+		std::unique_lock<std::shared_mutex> writeLock(lock);
+		KeystreamPtr &stored = keystreams[initialValue];
+		if(stored && stored->bytes.size() >= grown->bytes.size())
+		{
+			return stored;
+		}
+		size_t oldLength = (stored) ? stored->bytes.size() : 0;
+		stored = grown;
+		bytesCached += grown->bytes.size() - oldLength;
+		evict(initialValue);
+		return grown;
+	}
+
+	// evict(): Drops least recently used keystreams, other than one kept, until at most maxBytes are held.
+	// Caller must hold the lock exclusively. Calls still using a dropped keystream keep it alive until done.
+	void evict(unsigned int keptValue)
+	{
+		while(bytesCached > maxBytes && keystreams.size() > 1)
+		{
+			std::unordered_map<unsigned int, KeystreamPtr>::iterator victim = keystreams.end();
+			for(std::unordered_map<unsigned int, KeystreamPtr>::iterator it = keystreams.begin(); it != keystreams.end(); it++)
+			{
+				if(it->first != keptValue && (victim == keystreams.end() || it->second->lastUse < victim->second->lastUse))
+				{
+					victim = it;
+				}
+			}
+			bytesCached -= victim->second->bytes.size();
+			keystreams.erase(victim);
+			evictions++;
+		}
+	}
+
+public:
+	// Construct
+	KeystreamCache(size_t newMaxLength = KEYSTREAM_CACHE_DEFAULT_LENGTH, size_t newMaxBytes = KEYSTREAM_CACHE_DEFAULT_BYTES)
+		: maxLength(newMaxLength), maxBytes(newMaxBytes), hits(0), misses(0), bytesServed(0), bytesCached(0), evictions(0)
+	{
+	}
+
+	// cryptAt(): Encrypt (and decrypt) a range of data that starts at an offset within the keystream.
+	// Output is identical to the same range of Crypt() output. Source and destination may be the same buffer.
+	// Params: const unsigned char*; data to be encrypted, the bytes at offset..offset+dataLength of the whole.
+	// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+	// 		   size_t; length of the data.
+	// 		   unsigned int; initial value/key used for the encryption.
+	// 		   uint64_t; keystream offset of the first byte.
+	// Return: unsigned char*; destination pointer passed in, now holding the encrypted data.
+	unsigned char* cryptAt(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int initialValue, uint64_t offset)
+	{
+		uint64_t cachedEnd = (offset + dataLength < maxLength) ? (offset + dataLength) : maxLength;
+		size_t cachedLength = (offset < cachedEnd) ? (size_t)(cachedEnd - offset) : 0;
+		XorKernel xorKeystream = getXorKernel();
+
+		if(cachedLength > 0)
+		{
+			// Common case, keystream already long enough. Otherwise create or extend it
+			KeystreamPtr keystream = find(initialValue);
+			uint64_t now;
+			if(keystream && keystream->bytes.size() >= cachedEnd)
+			{
+				now = ++hits + misses;
+			}
+			else
+			{
+				now = ++misses + hits;
+				keystream = store(initialValue, grow(keystream, initialValue, cachedEnd));
+			}
+			if(keystream->lastUse.load(std::memory_order_relaxed) != now)
+			{
+				keystream->lastUse.store(now, std::memory_order_relaxed);
+			}
+			xorKeystream(src, keystream->bytes.data() + offset, dst, cachedLength);
+			bytesServed += cachedLength;
+		}
+
+		// Anything past the cache limit is generated directly
+		if(cachedLength < dataLength)
+		{
+			CryptFromKey(src + cachedLength, dst + cachedLength, dataLength - cachedLength, getKeyAtOffset(initialValue, offset + cachedLength));
+		}
+
+		return dst;
+	}
+
+	// crypt(): Encrypt (and decrypt) data with the cached keystream for an initial value.
+	// Output is identical to Crypt(). Source and destination may be the same buffer.
+	// Params: const unsigned char*; data to be encrypted.
+	// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+	// 		   size_t; length of the data.
+	// 		   unsigned int; initial value/key used for the encryption.
+	// Return: unsigned char*; destination pointer passed in, now holding the encrypted data.
+	unsigned char* crypt(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int initialValue)
+	{
+		return cryptAt(src, dst, dataLength, initialValue, 0);
+	}
+
+	// cryptInPlace(): Encrypt (and decrypt) caller-owned data in place with the cached keystream.
+	// Params: unsigned char*; data to be encrypted.
+	// 		   size_t; length of the data.
+	// 		   unsigned int; initial value/key used for the encryption.
+	// Return: unsigned char*; same pointer passed in, now with the data encrypted.
+	unsigned char* cryptInPlace(unsigned char* data, size_t dataLength, unsigned int initialValue)
+	{
+		return crypt(data, data, dataLength, initialValue);
+	}
+
+	// Misc
+	void clear()
+	{
+		std::unique_lock<std::shared_mutex> writeLock(lock);
+		keystreams.clear();
+		hits = 0;
+		misses = 0;
+		bytesServed = 0;
+		bytesCached = 0;
+		evictions = 0;
+	}
+
+	// Getters
+	size_t getMaxLength() const { return maxLength; }
+	size_t getMaxBytes() const { return maxBytes; }
+	KeystreamCacheStats getStats() const
+	{
+		KeystreamCacheStats stats;
+		stats.hits = hits;
+		stats.misses = misses;
+		stats.bytesServed = bytesServed;
+		stats.bytesCached = bytesCached;
+		stats.evictions = evictions;
+		return stats;
+	}
+};
+
+// getSharedKeystreamCache(): Process wide keystream cache, created on first use.
+// Return: KeystreamCache&; shared cache holding up to KEYSTREAM_CACHE_DEFAULT_LENGTH bytes per initial value,
+//		   and KEYSTREAM_CACHE_DEFAULT_BYTES in all.
+KeystreamCache& getSharedKeystreamCache()
+{
+	static KeystreamCache sharedCache;
+	return sharedCache;
+}
+
+#endif
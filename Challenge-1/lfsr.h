@@ -7,18 +7,37 @@
 
 #include <stdlib.h>
 #include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define LSFR_X86_SIMD
+#include <immintrin.h>
+#endif
 
 /*******************/
 /**** Constants ****/
 const unsigned int LSFR_FEEDBACK_VALUE = 0x87654321; 	// Feedback value for lsfr alg
 const unsigned int LSFR_NUM_STEPS = 8;					// Steps needed to generate new key
+const unsigned int LSFR_TABLE_SIZE = 256;				// Number of entries in the byte-at-a-time step table
+const unsigned int LSFR_REGISTER_BITS = 32;				// Width of the lsfr register
+const unsigned int LSFR_JUMP_POWERS = 64;				// Number of precomputed matrix powers, covers any 64 bit offset
+const size_t CRYPT_MIN_CHUNK = 64 * 1024;				// Smallest chunk handed to a thread by CryptParallel()
+const size_t CRYPT_BLOCK_SIZE = 4096;					// Keystream bytes materialized at a time before xor
+
+// Keystream engine selection. The table engine is used by default, define
+// LSFR_BIT_SERIAL before including this header to use the reference bit loop instead.
 
 /*******************/
 /***** Helper ******/
-// getNewKey(): Generates a new key from an initial value using the lsfr algorithm.
+// getNewKeyBitSerial(): Generates a new key from an initial value using the lsfr algorithm, one bit step at a time.
+// Reference implementation for the table engine.
 // Params: unsigned int; initial value to used to generate a new key. May be a previously generated key.
 // Return: unsigned int; new key value.
-unsigned int getNewKey(const unsigned int oldKey)
+unsigned int getNewKeyBitSerial(const unsigned int oldKey)
 {
  	// Step through lsfr alg
  	unsigned int newKey = oldKey;
@@ -37,36 +56,575 @@ unsigned int getNewKey(const unsigned int oldKey)
     return newKey;
 }
 
+/*******************/
+/** Table engine ***/
+// The register is linear, and bits above the low n bits never reach the feedback check within n steps,
+// so stepping a key n times (n <= 8) equals (key >> n) ^ table[key & ((1 << n) - 1)].
+
+// lfsrBitSteps(): Steps a key through the lsfr algorithm one bit at a time, for any feedback value.
+// Params: unsigned int; key to step.
+// 		   unsigned int; feedback value.
+// 		   unsigned int; number of bit steps.
+// Return: unsigned int; stepped key.
+constexpr unsigned int lfsrBitSteps(unsigned int key, const unsigned int feedback, const unsigned int numSteps)
+{
+	for(unsigned int i = 0; i < numSteps; i++)
+	{
+		key = ((key & 0x1) == 0x0) ? (key >> 1) : ((key >> 1) ^ feedback);
+	}
+
+	return key;
+}
+
+// LfsrFeedbackTable: Feedback applied after Bits steps, indexed by the low Bits bits of the register. Built at compile time.
+template<unsigned int Feedback, unsigned int Bits>
+struct LfsrFeedbackTable {
+	unsigned int feedback[1u << Bits];
+
+	constexpr LfsrFeedbackTable() : feedback()
+	{
+		for(unsigned int i = 0; i < (1u << Bits); i++)
+		{
+			feedback[i] = lfsrBitSteps(i, Feedback, Bits);
+		}
+	}
+};
+
+// Lfsr: lsfr algorithm for a feedback value and number of steps per key, fixed at compile time.
+// Steps are taken 8 at a time through a byte table, with any remaining steps through one smaller table.
+template<unsigned int Feedback, unsigned int Steps>
+class Lfsr {
+public:
+	static const unsigned int FEEDBACK = Feedback;
+	static const unsigned int NUM_STEPS = Steps;
+	static constexpr unsigned int TAIL_STEPS = Steps % 8;
+
+	static constexpr LfsrFeedbackTable<Feedback, 8> byteTable = LfsrFeedbackTable<Feedback, 8>();
+	static constexpr LfsrFeedbackTable<Feedback, TAIL_STEPS> tailTable = LfsrFeedbackTable<Feedback, TAIL_STEPS>();
+
+	// step(): Generates a new key from a previous key.
+	static constexpr unsigned int step(unsigned int key)
+	{
+		for(unsigned int i = 0; i < Steps / 8; i++)
+		{
+			key = (key >> 8) ^ byteTable.feedback[key & 0xFF];
+		}
+		if constexpr(TAIL_STEPS != 0)
+		{
+			key = (key >> TAIL_STEPS) ^ tailTable.feedback[key & ((1u << TAIL_STEPS) - 1)];
+		}
+
+		return key;
+	}
+
+	unsigned int operator()(const unsigned int key) const { return step(key); }
+};
+
+typedef Lfsr<LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS> DefaultLfsr;	// Parameters of the provided lsfr alg
+
+static_assert(DefaultLfsr::step(0x4F574154) == lfsrBitSteps(0x4F574154, LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS), "table engine must match bit loop");
+
+// getNewKeyTable(): Generates a new key from an initial value, advancing all 8 steps with a single table lookup.
+// Produces the same keys as getNewKeyBitSerial().
+// Params: unsigned int; initial value to used to generate a new key. May be a previously generated key.
+// Return: unsigned int; new key value.
+inline unsigned int getNewKeyTable(const unsigned int oldKey)
+{
+	return DefaultLfsr::step(oldKey);
+}
+
+// getNewKey(): Generates a new key from an initial value using the lsfr algorithm.
+// Uses the engine selected at compile time (see LSFR_BIT_SERIAL).
+// Params: unsigned int; initial value to used to generate a new key. May be a previously generated key.
+// Return: unsigned int; new key value.
+inline unsigned int getNewKey(const unsigned int oldKey)
+{
+#ifdef LSFR_BIT_SERIAL
+	return getNewKeyBitSerial(oldKey);
+#else
+	return getNewKeyTable(oldKey);
+#endif
+}
+
+/*******************/
+/**** Jump-ahead ***/
+// Each call to getNewKey() is a linear map over GF(2), so it can be written as a 32x32 bit matrix.
+// Matrices are stored as columns: column j is the key produced from a register with only bit j set.
+
+// applyGF2Matrix(): Multiplies a register value by a GF(2) matrix.
+// Params: const unsigned int*; matrix columns (LSFR_REGISTER_BITS of them).
+// 		   unsigned int; register value.
+// Return: unsigned int; transformed register value.
+inline unsigned int applyGF2Matrix(const unsigned int* matrix, unsigned int value)
+{
+	unsigned int result = 0;
+	for(unsigned int j = 0; value != 0; j++, value >>= 1)
+	{
+		if(value & 0x1)
+		{
+			result ^= matrix[j];
+		}
+	}
+
+	return result;
+}
+
+// LsfrJumpTable: Transition matrix of getNewKey() raised to every power of two, power[k] = M^(2^k).
+struct LsfrJumpTable {
+	unsigned int power[LSFR_JUMP_POWERS][LSFR_REGISTER_BITS];
+
+	LsfrJumpTable()
+	{
+		// Single step matrix
+		for(unsigned int j = 0; j < LSFR_REGISTER_BITS; j++)
+		{
+			power[0][j] = getNewKeyBitSerial(1u << j);
+		}
+
+		// Square repeatedly
+		for(unsigned int k = 1; k < LSFR_JUMP_POWERS; k++)
+		{
+			for(unsigned int j = 0; j < LSFR_REGISTER_BITS; j++)
+			{
+				power[k][j] = applyGF2Matrix(power[k - 1], power[k - 1][j]);
+			}
+		}
+	}
+};
+
+const LsfrJumpTable LSFR_JUMP_TABLE;
+
+// jumpKey(): Advances a key by any number of getNewKey() steps in O(log n).
+// Params: unsigned int; starting key.
+// 		   unsigned long long; number of getNewKey() steps to advance.
+// Return: unsigned int; key after numSteps steps.
+unsigned int jumpKey(unsigned int key, unsigned long long numSteps)
+{
+	for(unsigned int k = 0; numSteps != 0; k++, numSteps >>= 1)
+	{
+		if(numSteps & 0x1)
+		{
+			key = applyGF2Matrix(LSFR_JUMP_TABLE.power[k], key);
+		}
+	}
+
+	return key;
+}
+
+// getKeyAtOffset(): Gets the key Crypt() uses for a byte offset, without stepping through the bytes before it.
+// Params: unsigned int; initial value/key used for the encryption.
+// 		   unsigned long long; byte offset within the data.
+// Return: unsigned int; key applied to the byte at offset.
+unsigned int getKeyAtOffset(unsigned int initialValue, unsigned long long offset)
+{
+	return jumpKey(initialValue, offset + 1);
+}
+
 /*****************/
 /***** Crypt *****/
+// generateKeystream(): Writes keystream bytes starting at a given key.
+// Params: unsigned char*; destination for the keystream bytes.
+// 		   size_t; number of keystream bytes to write.
+// 		   unsigned int; key for the first keystream byte.
+// Return: unsigned int; key for the byte following the keystream, for continuing it.
+unsigned int generateKeystream(unsigned char* keystream, size_t length, unsigned int key)
+{
+	for(size_t i = 0; i < length; i++)
+	{
+		keystream[i] = (unsigned char)key;
+		key = getNewKey(key);
+	}
+
+	return key;
+}
+
+// XorKernel: Function computing dst[i] = src[i] ^ keystream[i] for length bytes. dst may equal src.
+typedef void (*XorKernel)(const unsigned char* src, const unsigned char* keystream, unsigned char* dst, size_t length);
+
+// xorKeystreamScalar(): Portable xor kernel.
+void xorKeystreamScalar(const unsigned char* src, const unsigned char* keystream, unsigned char* dst, size_t length)
+{
+	for(size_t i = 0; i < length; i++)
+	{
+		dst[i] = src[i] ^ keystream[i];
+	}
+}
+
+#ifdef LSFR_X86_SIMD
+// xorKeystreamSSE2(): xor kernel using 16 byte SSE2 lanes, scalar tail.
+__attribute__((target("sse2")))
+void xorKeystreamSSE2(const unsigned char* src, const unsigned char* keystream, unsigned char* dst, size_t length)
+{
+	size_t i = 0;
+	for(; i + 16 <= length; i += 16)
+	{
+		__m128i data = _mm_loadu_si128((const __m128i*)(src + i));
+		__m128i key = _mm_loadu_si128((const __m128i*)(keystream + i));
+		_mm_storeu_si128((__m128i*)(dst + i), _mm_xor_si128(data, key));
+	}
+	xorKeystreamScalar(src + i, keystream + i, dst + i, length - i);
+}
+
+// xorKeystreamAVX2(): xor kernel using 32 byte AVX2 lanes, scalar tail.
+__attribute__((target("avx2")))
+void xorKeystreamAVX2(const unsigned char* src, const unsigned char* keystream, unsigned char* dst, size_t length)
+{
+	size_t i = 0;
+	for(; i + 32 <= length; i += 32)
+	{
+		__m256i data = _mm256_loadu_si256((const __m256i*)(src + i));
+		__m256i key = _mm256_loadu_si256((const __m256i*)(keystream + i));
+		_mm256_storeu_si256((__m256i*)(dst + i), _mm256_xor_si256(data, key));
+	}
+	xorKeystreamScalar(src + i, keystream + i, dst + i, length - i);
+}
+#endif
+
+// getXorKernelName(): Name of the xor kernel chosen for this cpu.
+// Return: const char*; "avx2", "sse2" or "scalar".
+const char* getXorKernelName()
+{
+#ifdef LSFR_X86_SIMD
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return "avx2";
+	}
+	if(__builtin_cpu_supports("sse2"))
+	{
+		return "sse2";
+	}
+#endif
+	return "scalar";
+}
+
+// getXorKernel(): xor kernel chosen by cpu feature detection, selected once on first use.
+// Return: XorKernel; widest supported kernel.
+XorKernel getXorKernel()
+{
+	static const XorKernel kernel = []() -> XorKernel {
+		const char* name = getXorKernelName();
+#ifdef LSFR_X86_SIMD
+		if(strcmp(name, "avx2") == 0)
+		{
+			return xorKeystreamAVX2;
+		}
+		if(strcmp(name, "sse2") == 0)
+		{
+			return xorKeystreamSSE2;
+		}
+#endif
+		(void)name;
+		return xorKeystreamScalar;
+	}();
+
+	return kernel;
+}
+
+// CryptFromKeyBytewise(): Applies the keystream starting at a given key one byte at a time.
+// Reference for CryptFromKey().
+// Params: const unsigned char*; data to be encrypted.
+// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+// 		   size_t; length of the data.
+// 		   unsigned int; key applied to the first byte (see getKeyAtOffset()).
+// Return: unsigned int; key for the byte following the data, for continuing the keystream.
+unsigned int CryptFromKeyBytewise(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key)
+{
+	for(size_t i = 0; i < dataLength; i++)
+	{
+		dst[i] = src[i] ^ (unsigned char)key;
+		key = getNewKey(key);
+	}
+
+	return key;
+}
+
+// CryptFromKey(): Applies the keystream starting at a given key, from a source buffer into a destination buffer.
+// Notes: Keystream is generated CRYPT_BLOCK_SIZE bytes at a time into a stack buffer, then xor'd in
+//        with the kernel from getXorKernel(). Source and destination may be the same buffer.
+// Params: const unsigned char*; data to be encrypted.
+// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+// 		   size_t; length of the data.
+// 		   unsigned int; key applied to the first byte (see getKeyAtOffset()).
+// Return: unsigned int; key for the byte following the data, for continuing the keystream.
+unsigned int CryptFromKey(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key)
+{
+	XorKernel xorKeystream = getXorKernel();
+	unsigned char keystream[CRYPT_BLOCK_SIZE];
+	for(size_t pos = 0; pos < dataLength; pos += CRYPT_BLOCK_SIZE)
+	{
+		size_t length = (dataLength - pos < CRYPT_BLOCK_SIZE) ? (dataLength - pos) : CRYPT_BLOCK_SIZE;
+		key = generateKeystream(keystream, length, key);
+		xorKeystream(src + pos, keystream, dst + pos, length);
+	}
+
+	return key;
+}
+
+/*******************/
+/***** Engines *****/
+// generateKeystreamWith(): generateKeystream() for any stepper (callable taking and returning a key).
+template<class Stepper>
+unsigned int generateKeystreamWith(const Stepper &stepper, unsigned char* keystream, size_t length, unsigned int key)
+{
+	for(size_t i = 0; i < length; i++)
+	{
+		keystream[i] = (unsigned char)key;
+		key = stepper(key);
+	}
+
+	return key;
+}
+
+// CryptFromKeyWith(): CryptFromKey() for any stepper (callable taking and returning a key).
+template<class Stepper>
+unsigned int CryptFromKeyWith(const Stepper &stepper, const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key)
+{
+	XorKernel xorKeystream = getXorKernel();
+	unsigned char keystream[CRYPT_BLOCK_SIZE];
+	for(size_t pos = 0; pos < dataLength; pos += CRYPT_BLOCK_SIZE)
+	{
+		size_t length = (dataLength - pos < CRYPT_BLOCK_SIZE) ? (dataLength - pos) : CRYPT_BLOCK_SIZE;
+		key = generateKeystreamWith(stepper, keystream, length, key);
+		xorKeystream(src + pos, keystream, dst + pos, length);
+	}
+
+	return key;
+}
+
+// LfsrEngine: lsfr algorithm for parameters chosen at runtime, see getLfsrEngine().
+class LfsrEngine {
+public:
+	virtual ~LfsrEngine() {}
+
+	virtual unsigned int getFeedback() const = 0;
+	virtual unsigned int getNumSteps() const = 0;
+	virtual unsigned int step(unsigned int key) const = 0;
+	virtual unsigned int cryptFromKey(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key) const = 0;
+
+	// crypt(): Crypt() using this engine's parameters.
+	unsigned char* crypt(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int initialValue) const
+	{
+		cryptFromKey(src, dst, dataLength, step(initialValue));
+		return dst;
+	}
+};
+
+// StaticLfsrEngine: LfsrEngine backed by a compile time Lfsr, so the whole crypt loop is specialized.
+template<unsigned int Feedback, unsigned int Steps>
+class StaticLfsrEngine : public LfsrEngine {
+public:
+	unsigned int getFeedback() const { return Feedback; }
+	unsigned int getNumSteps() const { return Steps; }
+	unsigned int step(unsigned int key) const { return Lfsr<Feedback, Steps>::step(key); }
+	unsigned int cryptFromKey(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key) const
+	{
+		return CryptFromKeyWith(Lfsr<Feedback, Steps>(), src, dst, dataLength, key);
+	}
+};
+
+// RuntimeLfsrEngine: LfsrEngine for parameters with no compiled Lfsr, tables built on construction.
+class RuntimeLfsrEngine : public LfsrEngine {
+private:
+	unsigned int feedback;
+	unsigned int numSteps;
+	unsigned int tailSteps;
+	unsigned int byteTable[LSFR_TABLE_SIZE];
+	unsigned int tailTable[LSFR_TABLE_SIZE];
+
+public:
+	RuntimeLfsrEngine(unsigned int newFeedback, unsigned int newNumSteps)
+	{
+		feedback = newFeedback;
+		numSteps = newNumSteps;
+		tailSteps = numSteps % 8;
+		for(unsigned int i = 0; i < LSFR_TABLE_SIZE; i++)
+		{
+			byteTable[i] = lfsrBitSteps(i, feedback, 8);
+			tailTable[i] = lfsrBitSteps(i & ((1u << tailSteps) - 1), feedback, tailSteps);
+		}
+	}
+
+	unsigned int getFeedback() const { return feedback; }
+	unsigned int getNumSteps() const { return numSteps; }
+	unsigned int step(unsigned int key) const
+	{
+		for(unsigned int i = 0; i < numSteps / 8; i++)
+		{
+			key = (key >> 8) ^ byteTable[key & 0xFF];
+		}
+		if(tailSteps != 0)
+		{
+			key = (key >> tailSteps) ^ tailTable[key & ((1u << tailSteps) - 1)];
+		}
+
+		return key;
+	}
+	unsigned int operator()(const unsigned int key) const { return step(key); }
+	unsigned int cryptFromKey(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int key) const
+	{
+		return CryptFromKeyWith(*this, src, dst, dataLength, key);
+	}
+};
+
+// LfsrRegistry: Engines by (feedback, steps). Compiled engines are added with registerEngine(), any other
+// parameters get a RuntimeLfsrEngine on first request. Engines live as long as the registry.
+class LfsrRegistry {
+private:
+	std::mutex lock;
+	std::map<unsigned long long, std::unique_ptr<LfsrEngine> > engines;
+
+	static unsigned long long makeId(unsigned int feedback, unsigned int numSteps)
+	{
+		return ((unsigned long long)numSteps << 32) | feedback;
+	}
+
+public:
+	LfsrRegistry()
+	{
+		registerEngine<LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS>();
+	}
+
+	// registerEngine(): Adds the compiled engine for a parameter set. Engines are never replaced or freed while
+	// the registry lives, so references handed out by getEngine() stay valid. A parameter set already handed out
+	// keeps its runtime engine, which gives the same keys.
+	// Return: bool; flag for if the compiled engine was added.
+	template<unsigned int Feedback, unsigned int Steps>
+	bool registerEngine()
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::unique_ptr<LfsrEngine> &engine = engines[makeId(Feedback, Steps)];
+		if(engine != NULL)
+		{
+			return false;
+		}
+		engine.reset(new StaticLfsrEngine<Feedback, Steps>());
+		return true;
+	}
+
+	// getEngine(): Engine for a parameter set, compiled if registered. Valid for the life of the registry.
+	const LfsrEngine& getEngine(unsigned int feedback, unsigned int numSteps)
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		std::unique_ptr<LfsrEngine> &engine = engines[makeId(feedback, numSteps)];
+		if(engine == NULL)
+		{
+			engine.reset(new RuntimeLfsrEngine(feedback, numSteps));
+		}
+
+		return *engine;
+	}
+};
+
+// getLfsrRegistry(): Process wide engine registry, created on first use with the default parameters registered.
+LfsrRegistry& getLfsrRegistry()
+{
+	static LfsrRegistry registry;
+	return registry;
+}
+
+// getLfsrEngine(): Engine for lsfr parameters known only at runtime.
+// Params: unsigned int; feedback value.
+// 		   unsigned int; number of steps per key.
+// Return: const LfsrEngine&; engine for those parameters.
+const LfsrEngine& getLfsrEngine(unsigned int feedback, unsigned int numSteps)
+{
+	return getLfsrRegistry().getEngine(feedback, numSteps);
+}
+
+// Crypt(): Encrypt (and decrypt) data using the lsfr algorithm, from a source buffer into a destination buffer.
+// Notes: Source and destination may be the same buffer. No memory is allocated.
+// Params: const unsigned char*; data to be encrypted.
+// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+// 		   size_t; length of the data.
+// 		   unsigned int; initial value/key used for the encryption.
+// Return: unsigned char*; destination pointer passed in, now holding the encrypted data.
+unsigned char* Crypt(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int initialValue)
+{
+	CryptFromKey(src, dst, dataLength, getNewKey(initialValue));
+	return dst;
+}
+
+// CryptInPlace(): Encrypt (and decrypt) caller-owned data in place using the lsfr algorithm.
+// Notes: Encrypted data replaces original data passed in. No memory is allocated.
+// Params: unsigned char*; data to be encrypted.
+// 		   size_t; length of the data.
+// 		   unsigned int; initial value/key used for the encryption.
+// Return: unsigned char*; same pointer passed in, now with the data encrypted.
+unsigned char* CryptInPlace(unsigned char* data, size_t dataLength, unsigned int initialValue)
+{
+	return Crypt(data, data, dataLength, initialValue);
+}
+
 // Crypt(): Encrypt (and decrypt) data using the lsfr algorithm.
-// Notes: Encrypted data replaces original data passed in.
+// Notes: Encrypted data replaces original data passed in. Kept for existing callers, see CryptInPlace().
 // Params: unsigned char*; data to be encrypted.
 // 		   int; length of the data.
 // 		   unsigned int; initial value/key used for the encryption.
 // Return: unsigned char*; same pointer passed in, now with the data encrypted.
 unsigned char* Crypt(unsigned char* data, int dataLength, unsigned int initialValue) 
 {
-	// Place data into buffer
-	unsigned char* dataBuffer = (unsigned char*)calloc(dataLength, sizeof(unsigned char));
-	memcpy(dataBuffer, data, dataLength);
+	if(dataLength <= 0)
+	{
+		return data;
+	}
 
-	// Encrypt
-	unsigned int key = getNewKey(initialValue);
-	for(int i = 0; i < dataLength; i++)
+	return CryptInPlace(data, (size_t)dataLength, initialValue);
+}
+
+// CryptParallel(): Encrypt (and decrypt) data across multiple threads using the lsfr algorithm.
+// Notes: Data is split into one chunk per thread, and each thread seeds its keystream at its chunk
+//        start with getKeyAtOffset(). Output is identical to Crypt(). Source and destination may be the same buffer.
+// Params: const unsigned char*; data to be encrypted.
+// 		   unsigned char*; destination for the encrypted data, at least dataLength bytes.
+// 		   size_t; length of the data.
+// 		   unsigned int; initial value/key used for the encryption.
+// 		   unsigned int; maximum number of threads to use. Fewer are used for data under CRYPT_MIN_CHUNK per thread.
+// Return: unsigned char*; destination pointer passed in, now holding the encrypted data.
+unsigned char* CryptParallel(const unsigned char* src, unsigned char* dst, size_t dataLength, unsigned int initialValue, unsigned int numThreads)
+{
+	// Limit threads so each gets a worthwhile chunk
+	size_t maxThreads = dataLength / CRYPT_MIN_CHUNK;
+	if(maxThreads < numThreads)
 	{
-		dataBuffer[i] = dataBuffer[i] ^ key;
-		key = getNewKey(key);
+		numThreads = (maxThreads == 0) ? 1 : (unsigned int)maxThreads;
+	}
+	if(numThreads <= 1)
+	{
+		return Crypt(src, dst, dataLength, initialValue);
 	}
 
-	// Replace data
-	memcpy(data, dataBuffer, dataLength);
+	// Decrypt chunks, the calling thread takes the first
+	size_t chunkSize = (dataLength + numThreads - 1) / numThreads;
+	std::vector<std::thread> workers;
+	for(unsigned int t = 1; t < numThreads; t++)
+	{
+		size_t start = t * chunkSize;
+		if(start >= dataLength)
+		{
+			break;
+		}
+		size_t length = (dataLength - start < chunkSize) ? (dataLength - start) : chunkSize;
+		workers.push_back(std::thread(CryptFromKey, src + start, dst + start, length, getKeyAtOffset(initialValue, start)));
+	}
+	CryptFromKey(src, dst, chunkSize, getNewKey(initialValue));
 
-	// Clean buffer
-	free(dataBuffer);
-	dataBuffer = NULL;
+	for(size_t t = 0; t < workers.size(); t++)
+	{
+		workers[t].join();
+	}
 
-	return data;
+	return dst;
+}
+
+// CryptParallel(): Encrypt (and decrypt) caller-owned data in place across multiple threads.
+// Params: unsigned char*; data to be encrypted.
+// 		   size_t; length of the data.
+// 		   unsigned int; initial value/key used for the encryption.
+// 		   unsigned int; maximum number of threads to use.
+// Return: unsigned char*; same pointer passed in, now with the data encrypted.
+unsigned char* CryptParallel(unsigned char* data, size_t dataLength, unsigned int initialValue, unsigned int numThreads)
+{
+	return CryptParallel(data, data, dataLength, initialValue, numThreads);
 }
 
 
@@ -1,10 +1,35 @@
 #include <iostream>
 #include <string>
+#include <chrono>
 
 #include "lfsr.h"
+#include "keystreamCache.h"
 
 using namespace std;
 
+/********* Allocation count **********/
+// Counts heap allocations made through malloc/calloc (operator new included) so benchmarks can
+// report allocations per call. Only available with glibc, where the real allocator can be forwarded to.
+#ifdef __GLIBC__
+#define COUNT_ALLOCATIONS
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+
+static size_t allocation_count = 0;
+
+extern "C" void* malloc(size_t size) noexcept
+{
+	allocation_count++;
+	return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+	allocation_count++;
+	return __libc_calloc(count, size);
+}
+#endif
+
 /************* Utility ***************/
 void print_data(unsigned char* data, int len)
 {
@@ -32,8 +57,513 @@ void print_data(unsigned char* data, int len)
 
 }
 
-int main() 
+// fill_data(): fills a buffer with repeatable pseudo-random bytes.
+void fill_data(unsigned char* data, size_t len)
+{
+	unsigned int seed = 0x12345678;
+	for(size_t i = 0; i < len; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		data[i] = (unsigned char)(seed >> 16);
+	}
+}
+
+// crypt_with(): Crypt() loop using a specific key engine, for comparing engines within one build.
+template<unsigned int (*NextKey)(unsigned int)>
+void crypt_with(unsigned char* data, size_t len, unsigned int initialValue)
+{
+	unsigned int key = NextKey(initialValue);
+	for(size_t i = 0; i < len; i++)
+	{
+		data[i] = data[i] ^ key;
+		key = NextKey(key);
+	}
+}
+
+// seconds_since(): elapsed wall time since start, in seconds.
+double seconds_since(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+/************** Tests ****************/
+// run_tests(): checks the table engine against the reference bit loop. Returns number of failures.
+int run_tests()
+{
+	int failures = 0;
+
+	// Every low byte, with varied high bits
+	for(unsigned int i = 0; i < 0x10000; i++)
+	{
+		unsigned int key = (i * 0x9E3779B9) ^ i;
+		if(getNewKeyTable(key) != getNewKeyBitSerial(key))
+		{
+			fprintf(stderr, "FAIL: table engine mismatch for key %x\n", key);
+			failures++;
+		}
+	}
+
+	// Full Crypt() output against the reference loop
+	const size_t len = 4096;
+	unsigned char* expected = (unsigned char*)malloc(len);
+	unsigned char* actual = (unsigned char*)malloc(len);
+	fill_data(expected, len);
+	memcpy(actual, expected, len);
+	crypt_with<getNewKeyBitSerial>(expected, len, 0x4F574154);
+	Crypt(actual, (int)len, 0x4F574154);
+	if(memcmp(expected, actual, len) != 0)
+	{
+		fprintf(stderr, "FAIL: Crypt() differs from reference bit loop\n");
+		failures++;
+	}
+
+	// Out-of-place and in-place overloads against the legacy signature
+	unsigned char* outOfPlace = (unsigned char*)malloc(len);
+	fill_data(actual, len);
+	Crypt(actual, outOfPlace, len, 0x4F574154);
+	CryptInPlace(actual, len, 0x4F574154);
+	if(memcmp(expected, actual, len) != 0 || memcmp(expected, outOfPlace, len) != 0)
+	{
+		fprintf(stderr, "FAIL: Crypt() overloads differ from legacy Crypt()\n");
+		failures++;
+	}
+	free(outOfPlace);
+
+	// Jump-ahead against sequential stepping, at every offset up to 100000 and at scattered large offsets
+	unsigned int sequentialKey = 0x4F574154;
+	for(unsigned long long offset = 0; offset < 100000; offset++)
+	{
+		sequentialKey = getNewKeyBitSerial(sequentialKey);
+		if(getKeyAtOffset(0x4F574154, offset) != sequentialKey)
+		{
+			fprintf(stderr, "FAIL: jump-ahead mismatch at offset %llu\n", offset);
+			failures++;
+			break;
+		}
+	}
+	for(unsigned int trial = 0; trial < 64; trial++)
+	{
+		unsigned int startKey = trial * 0x9E3779B9 + 1;
+		unsigned long long base = 1ull << (trial % 24);
+		unsigned int jumped = jumpKey(startKey, base);
+		unsigned int stepped = startKey;
+		for(unsigned long long i = 0; i < base; i++)
+		{
+			stepped = getNewKey(stepped);
+		}
+		// jumps compose: base + base steps from the start equals base more from the jumped key
+		if(jumped != stepped || jumpKey(startKey, base * 2) != jumpKey(jumped, base))
+		{
+			fprintf(stderr, "FAIL: jump-ahead mismatch for key %x, %llu steps\n", startKey, base);
+			failures++;
+		}
+	}
+	free(expected);
+	free(actual);
+
+	// Parallel decrypt against serial, across lengths around chunk boundaries and thread counts
+	const size_t parallelLen = 4 * CRYPT_MIN_CHUNK + 17;
+	unsigned char* serial = (unsigned char*)malloc(parallelLen);
+	unsigned char* parallel = (unsigned char*)malloc(parallelLen);
+	size_t testLengths[] = {0, 1, CRYPT_MIN_CHUNK - 1, 2 * CRYPT_MIN_CHUNK, 3 * CRYPT_MIN_CHUNK + 1, parallelLen};
+	for(size_t l = 0; l < sizeof(testLengths) / sizeof(testLengths[0]); l++)
+	{
+		for(unsigned int numThreads = 1; numThreads <= 8; numThreads++)
+		{
+			fill_data(serial, testLengths[l]);
+			memcpy(parallel, serial, testLengths[l]);
+			CryptInPlace(serial, testLengths[l], 0x4F574154);
+			CryptParallel(parallel, testLengths[l], 0x4F574154, numThreads);
+			if(memcmp(serial, parallel, testLengths[l]) != 0)
+			{
+				fprintf(stderr, "FAIL: CryptParallel() differs from serial, length %zu, %u threads\n", testLengths[l], numThreads);
+				failures++;
+			}
+		}
+	}
+	free(serial);
+	free(parallel);
+
+	// Blocked SIMD path against the bytewise loop, lengths crossing block and lane boundaries
+	unsigned char* blocked = (unsigned char*)malloc(3 * CRYPT_BLOCK_SIZE + 33);
+	unsigned char* bytewise = (unsigned char*)malloc(3 * CRYPT_BLOCK_SIZE + 33);
+	for(size_t blockLen = 0; blockLen <= 3 * CRYPT_BLOCK_SIZE + 33; blockLen += 31)
+	{
+		fill_data(blocked, blockLen);
+		memcpy(bytewise, blocked, blockLen);
+		unsigned int blockedKey = CryptFromKey(blocked, blocked, blockLen, 0x4F574154);
+		unsigned int bytewiseKey = CryptFromKeyBytewise(bytewise, bytewise, blockLen, 0x4F574154);
+		if(blockedKey != bytewiseKey || memcmp(blocked, bytewise, blockLen) != 0)
+		{
+			fprintf(stderr, "FAIL: %s kernel differs from bytewise loop, length %zu\n", getXorKernelName(), blockLen);
+			failures++;
+		}
+	}
+	free(blocked);
+	free(bytewise);
+
+	// Keystream cache against Crypt(), growing the cached keystream and running past its limit
+	KeystreamCache cache(3 * CRYPT_BLOCK_SIZE + 5);
+	const size_t cacheTestLen = 5 * CRYPT_BLOCK_SIZE;
+	unsigned char* uncached = (unsigned char*)malloc(cacheTestLen);
+	unsigned char* cached = (unsigned char*)malloc(cacheTestLen);
+	size_t cacheLengths[] = {1, 100, 100, 5000, 4096 * 3 + 5, cacheTestLen, 17, cacheTestLen};
+	for(size_t l = 0; l < sizeof(cacheLengths) / sizeof(cacheLengths[0]); l++)
+	{
+		unsigned int initialValue = (l % 2 == 0) ? 0x4F574154 : 0x12345678;
+		fill_data(uncached, cacheLengths[l]);
+		Crypt(uncached, cached, cacheLengths[l], initialValue);
+		CryptInPlace(uncached, cacheLengths[l], initialValue);
+		cache.cryptInPlace(cached, cacheLengths[l], initialValue);
+		CryptInPlace(cached, cacheLengths[l], initialValue);
+		if(memcmp(uncached, cached, cacheLengths[l]) != 0)
+		{
+			fprintf(stderr, "FAIL: KeystreamCache differs from Crypt(), length %zu\n", cacheLengths[l]);
+			failures++;
+		}
+	}
+	// Ranges at offsets, inside, across and past the cache limit
+	size_t rangeStarts[] = {0, 7, 4096, 3 * CRYPT_BLOCK_SIZE, 3 * CRYPT_BLOCK_SIZE + 5, 4 * CRYPT_BLOCK_SIZE};
+	fill_data(uncached, cacheTestLen);
+	memcpy(cached, uncached, cacheTestLen);
+	CryptInPlace(uncached, cacheTestLen, 0x4F574154);
+	for(size_t r = 0; r < sizeof(rangeStarts) / sizeof(rangeStarts[0]); r++)
+	{
+		size_t rangeEnd = (r + 1 < sizeof(rangeStarts) / sizeof(rangeStarts[0])) ? rangeStarts[r + 1] : cacheTestLen;
+		cache.cryptAt(cached + rangeStarts[r], cached + rangeStarts[r], rangeEnd - rangeStarts[r], 0x4F574154, rangeStarts[r]);
+	}
+	if(memcmp(uncached, cached, cacheTestLen) != 0)
+	{
+		fprintf(stderr, "FAIL: KeystreamCache::cryptAt() differs from Crypt()\n");
+		failures++;
+	}
+
+	KeystreamCacheStats stats = cache.getStats();
+	if(stats.hits + stats.misses > sizeof(cacheLengths) / sizeof(cacheLengths[0]) + sizeof(rangeStarts) / sizeof(rangeStarts[0])
+		|| stats.bytesCached > 2 * cache.getMaxLength())
+	{
+		fprintf(stderr, "FAIL: KeystreamCache counters inconsistent\n");
+		failures++;
+	}
+	// Byte limit, keystreams of three initial values where only two fit, least recently used dropped
+	KeystreamCache smallCache(2 * CRYPT_BLOCK_SIZE, 4 * CRYPT_BLOCK_SIZE + 1);
+	unsigned int limitValues[] = {0x4F574154, 0x12345678, 0x4F574154, 0x9ABCDEF0, 0x4F574154, 0x12345678};
+	for(size_t v = 0; v < sizeof(limitValues) / sizeof(limitValues[0]); v++)
+	{
+		fill_data(uncached, 2 * CRYPT_BLOCK_SIZE);
+		memcpy(cached, uncached, 2 * CRYPT_BLOCK_SIZE);
+		CryptInPlace(uncached, 2 * CRYPT_BLOCK_SIZE, limitValues[v]);
+		smallCache.cryptInPlace(cached, 2 * CRYPT_BLOCK_SIZE, limitValues[v]);
+		if(memcmp(uncached, cached, 2 * CRYPT_BLOCK_SIZE) != 0)
+		{
+			fprintf(stderr, "FAIL: KeystreamCache differs from Crypt() after eviction\n");
+			failures++;
+		}
+	}
+	stats = smallCache.getStats();
+	if(stats.bytesCached > smallCache.getMaxBytes() || stats.evictions != 2 || stats.hits != 2 || stats.misses != 4)
+	{
+		fprintf(stderr, "FAIL: KeystreamCache byte limit not kept (cached %llu, evictions %llu)\n",
+			(unsigned long long)stats.bytesCached, (unsigned long long)stats.evictions);
+		failures++;
+	}
+	free(uncached);
+	free(cached);
+
+	// Templated and runtime engines against the bit loop, for other parameter sets
+	const unsigned int testFeedback = 0xEDB88320;
+	for(unsigned int i = 0; i < 0x10000; i++)
+	{
+		unsigned int key = (i * 0x9E3779B9) ^ i;
+		if(Lfsr<testFeedback, 3>::step(key) != lfsrBitSteps(key, testFeedback, 3)
+			|| Lfsr<testFeedback, 13>::step(key) != lfsrBitSteps(key, testFeedback, 13)
+			|| Lfsr<testFeedback, 32>::step(key) != lfsrBitSteps(key, testFeedback, 32)
+			|| getLfsrEngine(testFeedback, 13).step(key) != lfsrBitSteps(key, testFeedback, 13)
+			|| getLfsrEngine(LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS).step(key) != getNewKeyBitSerial(key))
+		{
+			fprintf(stderr, "FAIL: templated or runtime engine mismatch for key %x\n", key);
+			failures++;
+			break;
+		}
+	}
+	unsigned char* engineExpected = (unsigned char*)malloc(len);
+	unsigned char* engineActual = (unsigned char*)malloc(len);
+	fill_data(engineExpected, len);
+	fill_data(engineActual, len);
+	getLfsrEngine(LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS).crypt(engineActual, engineActual, len, 0x4F574154);
+	CryptInPlace(engineExpected, len, 0x4F574154);
+	if(memcmp(engineExpected, engineActual, len) != 0)
+	{
+		fprintf(stderr, "FAIL: registry engine differs from Crypt()\n");
+		failures++;
+	}
+	// Registering an engine already handed out keeps the one handed out
+	const LfsrEngine* handedOut = &getLfsrEngine(testFeedback, 3);
+	if(getLfsrRegistry().registerEngine<testFeedback, 3>() == true || &getLfsrEngine(testFeedback, 3) != handedOut
+		|| handedOut->step(0x4F574154) != lfsrBitSteps(0x4F574154, testFeedback, 3))
+	{
+		fprintf(stderr, "FAIL: registering an engine replaced one already handed out\n");
+		failures++;
+	}
+	free(engineExpected);
+	free(engineActual);
+
+	printf("%s (%d failures)\n", (failures == 0) ? "PASS" : "FAIL", failures);
+	return failures;
+}
+
+/************ Benchmarks *************/
+// run_bench(): reports keystream throughput of the bit loop and table engines in MB/s.
+void run_bench()
+{
+	const size_t len = 64 * 1024 * 1024;
+	unsigned char* data = (unsigned char*)malloc(len);
+	fill_data(data, len);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	crypt_with<getNewKeyBitSerial>(data, len, 0x4F574154);
+	double bitSeconds = seconds_since(start);
+
+	start = chrono::steady_clock::now();
+	crypt_with<getNewKeyTable>(data, len, 0x4F574154);
+	double tableSeconds = seconds_since(start);
+
+	double mb = (double)len / (1024 * 1024);
+	printf("%-12s %10.1f MB/s\n", "bit loop", mb / bitSeconds);
+	printf("%-12s %10.1f MB/s\n", "table", mb / tableSeconds);
+	printf("(checksum %x)\n", data[len / 2]);
+
+	free(data);
+}
+
+// run_alloc_bench(): reports heap allocations per call and throughput of the Crypt() overloads.
+void run_alloc_bench()
+{
+	const size_t len = 4096;
+	const int numCalls = 100000;
+	unsigned char* src = (unsigned char*)malloc(len);
+	unsigned char* dst = (unsigned char*)malloc(len);
+	fill_data(src, len);
+
+	printf("\n%-22s %12s %12s\n", "Crypt overload", "allocs/call", "MB/s");
+	for(int variant = 0; variant < 3; variant++)
+	{
+		#ifdef COUNT_ALLOCATIONS
+		size_t allocationsBefore = allocation_count;
+		#endif
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(int i = 0; i < numCalls; i++)
+		{
+			if(variant == 0) Crypt(src, (int)len, 0x4F574154);
+			else if(variant == 1) CryptInPlace(src, len, 0x4F574154);
+			else Crypt(src, dst, len, 0x4F574154);
+		}
+		double seconds = seconds_since(start);
+
+		const char* names[] = {"legacy (int length)", "in-place", "out-of-place"};
+		#ifdef COUNT_ALLOCATIONS
+		double allocsPerCall = (double)(allocation_count - allocationsBefore) / numCalls;
+		printf("%-22s %12.2f %12.1f\n", names[variant], allocsPerCall, ((double)len * numCalls / (1024 * 1024)) / seconds);
+		#else
+		printf("%-22s %12s %12.1f\n", names[variant], "n/a", ((double)len * numCalls / (1024 * 1024)) / seconds);
+		#endif
+	}
+
+	free(src);
+	free(dst);
+}
+
+// run_thread_bench(): reports CryptParallel() throughput and speedup for 1..N threads.
+void run_thread_bench()
 {
+	const size_t len = 256 * 1024 * 1024;
+	unsigned char* data = (unsigned char*)malloc(len);
+	fill_data(data, len);
+
+	unsigned int maxThreads = thread::hardware_concurrency();
+	if(maxThreads < 4)
+	{
+		maxThreads = 4;
+	}
+
+	printf("\n%-10s %12s %10s   (%u hardware threads)\n", "threads", "MB/s", "speedup", thread::hardware_concurrency());
+	double baseSeconds = 0;
+	for(unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		CryptParallel(data, len, 0x4F574154, numThreads);
+		double seconds = seconds_since(start);
+		if(numThreads == 1)
+		{
+			baseSeconds = seconds;
+		}
+		printf("%-10u %12.1f %9.2fx\n", numThreads, ((double)len / (1024 * 1024)) / seconds, baseSeconds / seconds);
+	}
+
+	free(data);
+}
+
+// run_simd_bench(): compares the blocked SIMD xor path against the bytewise loop, 1 KiB up to maxMiB MiB payloads.
+void run_simd_bench(size_t maxMiB)
+{
+	const size_t maxLen = maxMiB * 1024 * 1024;
+	const size_t bytesPerSize = 256 * 1024 * 1024; // processed per payload size, repeating small payloads
+	unsigned char* data = (unsigned char*)malloc(maxLen);
+	fill_data(data, maxLen);
+
+	unsigned char* keystream = (unsigned char*)malloc(CRYPT_BLOCK_SIZE);
+	generateKeystream(keystream, CRYPT_BLOCK_SIZE, 0x4F574154);
+	XorKernel kernel = getXorKernel();
+
+	printf("\n%-12s %14s %14s %14s %14s\n", "payload", "bytewise MB/s", "blocked MB/s", "xor scalar", (string("xor ") + getXorKernelName()).c_str());
+	for(size_t len = 1024; len <= maxLen; len *= 4)
+	{
+		size_t repeats = (bytesPerSize / len > 0) ? bytesPerSize / len : 1;
+		double mb = ((double)len * repeats) / (1024 * 1024);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(size_t r = 0; r < repeats; r++)
+		{
+			CryptFromKeyBytewise(data, data, len, 0x4F574154);
+		}
+		double bytewiseSeconds = seconds_since(start);
+
+		start = chrono::steady_clock::now();
+		for(size_t r = 0; r < repeats; r++)
+		{
+			CryptFromKey(data, data, len, 0x4F574154);
+		}
+		double blockedSeconds = seconds_since(start);
+
+		// xor stage alone, against an already generated keystream block
+		double xorSeconds[2];
+		for(int k = 0; k < 2; k++)
+		{
+			XorKernel xorKeystream = (k == 0) ? xorKeystreamScalar : kernel;
+			start = chrono::steady_clock::now();
+			for(size_t r = 0; r < repeats; r++)
+			{
+				for(size_t pos = 0; pos < len; pos += CRYPT_BLOCK_SIZE)
+				{
+					size_t blockLen = (len - pos < CRYPT_BLOCK_SIZE) ? (len - pos) : CRYPT_BLOCK_SIZE;
+					xorKeystream(data + pos, keystream, data + pos, blockLen);
+				}
+			}
+			xorSeconds[k] = seconds_since(start);
+		}
+
+		printf("%8zu KiB %14.1f %14.1f %14.1f %14.1f\n", len / 1024, mb / bytewiseSeconds, mb / blockedSeconds, mb / xorSeconds[0], mb / xorSeconds[1]);
+	}
+
+	free(keystream);
+	free(data);
+}
+
+// HandTable: runtime built byte table, the engine the Lfsr template replaced, kept as a bench baseline.
+struct HandTable {
+	unsigned int feedback[LSFR_TABLE_SIZE];
+
+	HandTable()
+	{
+		for(unsigned int i = 0; i < LSFR_TABLE_SIZE; i++)
+		{
+			feedback[i] = getNewKeyBitSerial(i);
+		}
+	}
+	unsigned int operator()(const unsigned int key) const { return (key >> 8) ^ feedback[key & 0xFF]; }
+};
+
+// run_engine_bench(): compares the hand-written table, the Lfsr template, and registry engines.
+void run_engine_bench()
+{
+	const size_t len = 64 * 1024 * 1024;
+	unsigned char* data = (unsigned char*)malloc(len);
+	fill_data(data, len);
+	double mb = (double)len / (1024 * 1024);
+
+	HandTable handTable;
+	const LfsrEngine &defaultEngine = getLfsrEngine(LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS);
+	const LfsrEngine &runtimeDefault = RuntimeLfsrEngine(LSFR_FEEDBACK_VALUE, LSFR_NUM_STEPS);
+	const LfsrEngine &runtimeOther = getLfsrEngine(0xEDB88320, 13);
+
+	printf("\n%-28s %10s\n", "engine", "MB/s");
+	for(int variant = 0; variant < 5; variant++)
+	{
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		const char* name = "";
+		switch(variant)
+		{
+			case 0: name = "hand-written table"; CryptFromKeyWith(handTable, data, data, len, 0x4F574154); break;
+			case 1: name = "Lfsr<default>"; CryptFromKeyWith(DefaultLfsr(), data, data, len, 0x4F574154); break;
+			case 2: name = "registry, compiled default"; defaultEngine.cryptFromKey(data, data, len, 0x4F574154); break;
+			case 3: name = "runtime engine, default"; runtimeDefault.cryptFromKey(data, data, len, 0x4F574154); break;
+			case 4: name = "runtime engine, 13 steps"; runtimeOther.cryptFromKey(data, data, len, 0x4F574154); break;
+		}
+		printf("%-28s %10.1f\n", name, mb / seconds_since(start));
+	}
+
+	free(data);
+}
+
+// run_cache_bench(): decrypts many small entries with Crypt() and with the shared keystream cache.
+void run_cache_bench()
+{
+	const size_t numEntries = 20000;
+	const size_t maxEntrySize = 8192;
+	size_t* sizes = (size_t*)malloc(numEntries * sizeof(size_t));
+	size_t totalSize = 0;
+	for(size_t i = 0; i < numEntries; i++)
+	{
+		sizes[i] = 16 + (i * 2654435761u) % maxEntrySize;
+		totalSize += sizes[i];
+	}
+	unsigned char* data = (unsigned char*)malloc(totalSize);
+	fill_data(data, totalSize);
+	double mb = (double)totalSize / (1024 * 1024);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for(size_t i = 0, pos = 0; i < numEntries; pos += sizes[i], i++)
+	{
+		CryptInPlace(data + pos, sizes[i], 0x4F574154);
+	}
+	double cryptSeconds = seconds_since(start);
+
+	KeystreamCache &cache = getSharedKeystreamCache();
+	start = chrono::steady_clock::now();
+	for(size_t i = 0, pos = 0; i < numEntries; pos += sizes[i], i++)
+	{
+		cache.cryptInPlace(data + pos, sizes[i], 0x4F574154);
+	}
+	double cacheSeconds = seconds_since(start);
+
+	KeystreamCacheStats stats = cache.getStats();
+	printf("\n%zu entries of 16..%zu bytes\n", numEntries, maxEntrySize + 15);
+	printf("%-12s %10.1f MB/s\n", "Crypt", mb / cryptSeconds);
+	printf("%-12s %10.1f MB/s   (hits %llu, misses %llu, served %llu bytes, cached %llu bytes)\n", "cached", mb / cacheSeconds,
+		(unsigned long long)stats.hits, (unsigned long long)stats.misses, (unsigned long long)stats.bytesServed, (unsigned long long)stats.bytesCached);
+
+	free(sizes);
+	free(data);
+}
+
+int main(int argc, char* argv[]) 
+{
+	string mode = (argc > 1) ? argv[1] : "";
+	if(mode == "test")
+	{
+		return (run_tests() == 0) ? 0 : 1;
+	}
+	else if(mode == "bench")
+	{
+		run_bench();
+		run_alloc_bench();
+		run_thread_bench();
+		run_cache_bench();
+		run_engine_bench();
+		run_simd_bench((argc > 2) ? strtoul(argv[2], NULL, 10) : 64);
+		return 0;
+	}
+
 	int dataLength = 5;
 	unsigned char* data = (unsigned char*)malloc(dataLength*sizeof(unsigned char));
 	data[0] = 'a';
@@ -1,6 +1,6 @@
 // David Ramsey
 // Last updated 01/31/2021
-// Dependencies: lsfr.h
+// Dependencies: lsfr.h mappedFile.h
 // REFERENCES:
 // - For opending a binary file properly, and getting file length: http://www.cplusplus.com/reference/istream/istream/read/
 // - For formatting output via iomanip library, Reference: https://www.cplusplus.com/reference/iomanip/
@@ -14,6 +14,7 @@
 #include <vector>
 
 #include "lfsr.h"
+#include "mappedFile.h"
 
 using namespace std;
 
@@ -79,22 +80,15 @@ bool checkForListEnd(const unsigned char* buffer, const int32_t startPos)
 /********* Main ********/
 int main(int argc, char* argv[])
 {
-	// Open kdb file stream
+	// Map kdb file, entries are read in place without copying the file
 	string kdbFileName = argv[1];
-	ifstream kdbStream;
-	kdbStream.open(kdbFileName, ifstream::binary | ifstream::in); // read as binary, Reference: http://www.cplusplus.com/reference/istream/istream/read/
-	
-	// Get file length, Reference: http://www.cplusplus.com/reference/istream/istream/read/
-	kdbStream.seekg(0, kdbStream.end);
-	int kdbStreamLen = kdbStream.tellg();
-	kdbStream.seekg(0, kdbStream.beg);
-
-	// Put kdbFile into buffer
-	unsigned char* kdbBuffer = new unsigned char[kdbStreamLen];
-	kdbStream.read((char*)kdbBuffer, kdbStreamLen);
-
-	// Close file
-	kdbStream.close();
+	MappedFile kdbFile(kdbFileName, ACCESS_RANDOM);
+	if(kdbFile.isOpen() == false)
+	{
+		cerr << "Could not open " << kdbFileName << endl;
+		return 1;
+	}
+	const unsigned char* kdbBuffer = kdbFile.getData();
 
 	// Read entry list position
 	int32_t entryListPos = readLittleEndian<int32_t>(kdbBuffer, NUM_MAGIC_BYTES);
@@ -152,9 +146,9 @@ int main(int argc, char* argv[])
 		entryIndex += ENTRY_SIZE;
 	}
 
-	// Clean buffer
-	delete [] kdbBuffer;
+	// Unmap file
 	kdbBuffer = NULL;
+	kdbFile.close();
 
 	// Print entries
 	cout << endl << setw(16) << "Name" << " -- Data" << endl; // formatting via iomanip library, Reference: https://www.cplusplus.com/reference/iomanip/
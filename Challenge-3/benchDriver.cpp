@@ -0,0 +1,1791 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: parseKDB.h writeKDB.h carveJPEG.h multiMD5.h contentSet.h lsfr.h keystreamCache.h mappedFile.h
+// Benchmarks for kdb parsing, run as: bench.exe <benchmark> [size in MiB]
+// REFERENCES:
+// - For formatting output via iomanip library, Reference: https://www.cplusplus.com/reference/iomanip/
+// - Child process resource usage, Reference: https://man7.org/linux/man-pages/man2/wait4.2.html
+
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "parseKDB.h"
+#include "writeKDB.h"
+#include "carveJPEG.h"
+#include "multiMD5.h"
+#include "contentSet.h"
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+const string BENCH_KDB_PATH = "/tmp/bench_store.kdb";	// Synthetic store written by benchmarks
+const string BENCH_CARVE_PATH = "/tmp/bench_carve.bin";	// Synthetic carve input written by benchmarks
+const unsigned char BENCH_MAGIC_BYTES[NUM_MAGIC_BYTES] = {'C', 'T', '2', '0', '1', '8'}; // Header of synthetic stores
+
+/***********************/
+/******* Utility *******/
+// secondsSince(): elapsed wall time since start, in seconds.
+double secondsSince(chrono::steady_clock::time_point start)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// writeSyntheticKDB(): Writes a fragmented kdb store. Each entry's blocks are written in reverse
+// order, so gathering an entry jumps backwards through the file.
+// Params:	string; output path
+//			uint64_t; total entry data size in bytes
+//			uint32_t; size of each entry
+//			uint16_t; size of each block (at most 32767)
+// Return:	uint32_t; number of entries written
+uint32_t writeSyntheticKDB(const string fileName, const uint64_t totalSize, const uint32_t entrySize, const uint16_t blockSize)
+{
+	ofstream kdbStream(fileName, ofstream::binary | ofstream::trunc);
+	uint32_t numEntries = (uint32_t)(totalSize / entrySize);
+	uint32_t blocksPerEntry = (entrySize + blockSize - 1) / blockSize;
+
+	// Header, entry list position filled in at the end
+	kdbStream.write((const char*)BENCH_MAGIC_BYTES, NUM_MAGIC_BYTES);
+	writeLittleEndian<uint32_t>(kdbStream, 0);
+
+	// Data blocks, entry by entry with blocks reversed
+	vector<uint32_t> blockPos(blocksPerEntry);
+	vector<uint32_t> blockListPos(numEntries);
+	vector<unsigned char> blockLists;
+	unsigned char* data = new unsigned char[entrySize];
+	for(uint32_t e = 0; e < numEntries; e++)
+	{
+		for(uint32_t k = 0; k < entrySize; k++)
+		{
+			data[k] = (unsigned char)('a' + (e + k) % 26);
+		}
+		getSharedKeystreamCache().cryptInPlace(data, entrySize, DECRYPT_KEY);
+
+		for(int32_t b = (int32_t)blocksPerEntry - 1; b >= 0; b--)
+		{
+			uint32_t start = b * blockSize;
+			uint32_t length = (entrySize - start < blockSize) ? (entrySize - start) : blockSize;
+			blockPos[b] = (uint32_t)kdbStream.tellp();
+			kdbStream.write((const char*)&data[start], length);
+		}
+
+		// Block list for entry, kept in memory until the data is written
+		blockListPos[e] = (uint32_t)blockLists.size();
+		for(uint32_t b = 0; b < blocksPerEntry; b++)
+		{
+			uint32_t start = b * blockSize;
+			uint16_t length = (uint16_t)((entrySize - start < blockSize) ? (entrySize - start) : blockSize);
+			for(int i = 0; i < 2; i++) blockLists.push_back((unsigned char)(length >> (i * BYTE)));
+			for(int i = 0; i < 4; i++) blockLists.push_back((unsigned char)(blockPos[b] >> (i * BYTE)));
+		}
+		for(int i = 0; i < 4; i++) blockLists.push_back(0xFF);
+	}
+	delete [] data;
+
+	// Block lists, then entry list
+	uint32_t blockListsStart = (uint32_t)kdbStream.tellp();
+	kdbStream.write((const char*)blockLists.data(), blockLists.size());
+	uint32_t entryListPos = (uint32_t)kdbStream.tellp();
+	for(uint32_t e = 0; e < numEntries; e++)
+	{
+		char name[MAX_ENTRY_NAME] = {0};
+		snprintf(name, MAX_ENTRY_NAME, "ENTRY%u", e);
+		kdbStream.write(name, MAX_ENTRY_NAME);
+		writeLittleEndian<uint32_t>(kdbStream, blockListsStart + blockListPos[e]);
+	}
+	writeLittleEndian<uint32_t>(kdbStream, 0xFFFFFFFF);
+
+	kdbStream.seekp(NUM_MAGIC_BYTES);
+	writeLittleEndian<uint32_t>(kdbStream, entryListPos);
+	kdbStream.close();
+
+	return numEntries;
+}
+
+// readStatusKiB(): Reads one memory field of /proc/self/status (e.g. "RssAnon:").
+// Return:	long; value in KiB, 0 if the field is missing
+long readStatusKiB(const string field)
+{
+	ifstream status("/proc/self/status");
+	string line;
+	while(getline(status, line))
+	{
+		if(line.compare(0, field.size(), field) == 0)
+		{
+			return strtol(line.c_str() + field.size(), NULL, 10);
+		}
+	}
+	return 0;
+}
+
+long stepHeapPeak = 0;			// Peak anonymous memory seen by sampleHeap() in a runInChild() child, KiB
+volatile uint64_t stepSink = 0;	// Results of benchmark steps, kept so they are not optimized away
+
+// sampleHeap(): Records the anonymous memory of the process for runInChild(). Steps call it where their heap peaks.
+void sampleHeap()
+{
+	long anon = readStatusKiB("RssAnon:");
+	if(anon > stepHeapPeak)
+	{
+		stepHeapPeak = anon;
+	}
+}
+
+// runInChild(): Runs a benchmark step in a child process, so its peak memory is measured alone.
+// Freed heap of the parent is returned to the system first, so the step can not reuse inherited pages.
+// Peak RSS also counts mapped file pages the step touches, so the heap the step itself allocated is
+// reported as well: the growth of anonymous memory up to the highest sampleHeap() call of the step.
+// Params:	void(*)(); step to run
+//			(OUT) double; wall time in seconds
+//			(OUT) long; peak anonymous memory allocated by the step in KiB
+// Return:	long; peak resident set size of the child in KiB
+long runInChild(void (*step)(), double &seconds, long &heapKiB)
+{
+	int heapPipe[2];
+	if(pipe(heapPipe) != 0)
+	{
+		cerr << "pipe() failed" << endl;
+		exit(1);
+	}
+	cout.flush();
+	malloc_trim(0);
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	pid_t pid = fork();
+	if(pid == 0)
+	{
+		long baseAnon = readStatusKiB("RssAnon:");
+		stepHeapPeak = baseAnon;
+		step();
+		long growth = stepHeapPeak - baseAnon;
+		ssize_t written = write(heapPipe[1], &growth, sizeof(growth));
+		_exit(written == (ssize_t)sizeof(growth) ? 0 : 1);
+	}
+
+	close(heapPipe[1]);
+	heapKiB = 0;
+	if(read(heapPipe[0], &heapKiB, sizeof(heapKiB)) != (ssize_t)sizeof(heapKiB))
+	{
+		heapKiB = 0;
+	}
+	close(heapPipe[0]);
+	int status = 0;
+	struct rusage usage;
+	wait4(pid, &status, 0, &usage); // Reference: https://man7.org/linux/man-pages/man2/wait4.2.html
+	seconds = secondsSince(start);
+	return usage.ru_maxrss;
+}
+
+/***********************/
+/***** Benchmarks ******/
+// openWithBuffer(): Current path, whole store read into a heap buffer and every entry decrypted.
+void openWithBuffer()
+{
+	ifstream kdbStream(BENCH_KDB_PATH, ifstream::binary | ifstream::in);
+	kdbStream.seekg(0, kdbStream.end);
+	int32_t kdbStreamLen = kdbStream.tellg();
+	kdbStream.seekg(0, kdbStream.beg);
+	unsigned char* kdbBuffer = new unsigned char[kdbStreamLen];
+	kdbStream.read((char*)kdbBuffer, kdbStreamLen);
+	kdbStream.close();
+
+	vector<Entry> entryList = parseKDB(kdbBuffer, kdbStreamLen);
+	sampleHeap();
+	for(size_t i = 0; i < entryList.size(); i++)
+	{
+		delete [] entryList[i].data;
+	}
+	delete [] kdbBuffer;
+}
+
+// openWithReader(): Mapped path, entry and block lists walked in place, no entry data read.
+void openWithReader()
+{
+	KdbReader kdbReader(BENCH_KDB_PATH);
+	sampleHeap();
+	stepSink = kdbReader.getNumEntries();
+}
+
+// benchKdbOpen(): open+parse latency and peak RSS of the buffered and mapped paths.
+void benchKdbOpen(const uint64_t storeMiB)
+{
+	uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, 256 * 1024, 4096);
+
+	// Check both paths agree before timing
+	if(storeMiB <= 64)
+	{
+		MappedFile file(BENCH_KDB_PATH);
+		vector<Entry> entryList = parseKDB(file.getData(), file.getSize());
+		KdbReader kdbReader(BENCH_KDB_PATH);
+		unsigned char* data = new unsigned char[256 * 1024];
+		for(size_t i = 0; i < entryList.size(); i++)
+		{
+			if(kdbReader.getEntryName(i) != entryList[i].name || kdbReader.readEntry(i, data) != (uint64_t)entryList[i].size
+				|| memcmp(data, entryList[i].data, entryList[i].size) != 0)
+			{
+				cerr << "KdbReader differs from parseKDB() at entry " << i << endl;
+				exit(1);
+			}
+			delete [] entryList[i].data;
+		}
+		delete [] data;
+
+		// A failed reopen must not leave names pointing into the old mapping
+		string firstName = kdbReader.getEntryName(0);
+		if(kdbReader.open(BENCH_KDB_PATH + ".missing") == true || kdbReader.getNumEntries() != 0 || kdbReader.findEntry(firstName) != -1)
+		{
+			cerr << "KdbReader kept the previous store after a failed open" << endl;
+			exit(1);
+		}
+	}
+
+	cout << endl << "kdb-open: " << storeMiB << " MiB store, " << numEntries << " entries" << endl;
+	cout << setw(24) << "path" << setw(14) << "seconds" << setw(16) << "peak RSS MiB" << setw(14) << "heap KiB" << endl;
+	double seconds = 0;
+	long heapKiB = 0;
+	if(storeMiB < 2048) // buffered path holds the file length in an int32_t
+	{
+		long rss = runInChild(openWithBuffer, seconds, heapKiB);
+		cout << setw(24) << "buffer + parseKDB" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+	}
+	else
+	{
+		cout << setw(24) << "buffer + parseKDB" << setw(14) << "n/a" << setw(16) << "n/a" << setw(14) << "n/a" << endl;
+	}
+	long rss = runInChild(openWithReader, seconds, heapKiB);
+	cout << setw(24) << "mapped KdbReader" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// benchKdbLookup(): time to read one entry by name through eager parseKDB() and lazy parseKDBLazy().
+void benchKdbLookup(const uint64_t storeMiB)
+{
+	uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, 64 * 1024, 4096);
+	MappedFile file(BENCH_KDB_PATH);
+	char target[MAX_ENTRY_NAME];
+	snprintf(target, MAX_ENTRY_NAME, "ENTRY%u", numEntries / 2);
+
+	// Eager, every entry decrypted
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	vector<Entry> entryList = parseKDB(file.getData(), file.getSize());
+	const Entry* eagerEntry = NULL;
+	for(size_t i = 0; i < entryList.size(); i++)
+	{
+		if(entryList[i].name == target)
+		{
+			eagerEntry = &entryList[i];
+			break;
+		}
+	}
+	double eagerSeconds = secondsSince(start);
+
+	// Lazy, only the target decrypted
+	start = chrono::steady_clock::now();
+	vector<LazyEntry> lazyList = parseKDBLazy(file.getData(), file.getSize());
+	LazyEntry* lazyEntry = NULL;
+	for(size_t i = 0; i < lazyList.size(); i++)
+	{
+		if(lazyList[i].getName() == target)
+		{
+			lazyEntry = &lazyList[i];
+			lazyEntry->getData();
+			break;
+		}
+	}
+	double lazySeconds = secondsSince(start);
+
+	if(eagerEntry == NULL || lazyEntry == NULL || lazyEntry->getSize() != (uint64_t)eagerEntry->size
+		|| memcmp(lazyEntry->getData(), eagerEntry->data, eagerEntry->size) != 0)
+	{
+		cerr << "parseKDBLazy() differs from parseKDB() for " << target << endl;
+		exit(1);
+	}
+
+	cout << endl << "kdb-lookup: " << storeMiB << " MiB store, " << numEntries << " entries, reading " << target << endl;
+	cout << setw(24) << "parseKDB" << setw(14) << eagerSeconds << " s" << endl;
+	cout << setw(24) << "parseKDBLazy" << setw(14) << lazySeconds << " s" << endl;
+
+	for(size_t i = 0; i < entryList.size(); i++)
+	{
+		delete [] entryList[i].data;
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// makeEntryListBuffer(): Builds an in-memory kdb holding only an entry list, every entry pointing
+// at one empty block list. Caller owns the returned buffer, of bufferLen bytes.
+unsigned char* makeEntryListBuffer(const uint32_t numEntries, uint64_t &bufferLen)
+{
+	uint64_t entryListPos = NUM_MAGIC_BYTES + sizeof(uint32_t) + sizeof(uint32_t);
+	bufferLen = entryListPos + (uint64_t)numEntries * ENTRY_SIZE + sizeof(uint32_t);
+	unsigned char* kdbBuffer = new unsigned char[bufferLen];
+	memcpy(kdbBuffer, BENCH_MAGIC_BYTES, NUM_MAGIC_BYTES);
+	for(int i = 0; i < 4; i++) kdbBuffer[NUM_MAGIC_BYTES + i] = (unsigned char)(entryListPos >> (i * BYTE));
+	memset(&kdbBuffer[NUM_MAGIC_BYTES + sizeof(uint32_t)], 0xFF, sizeof(uint32_t)); // empty block list at offset 10
+	for(uint32_t e = 0; e < numEntries; e++)
+	{
+		unsigned char* entry = &kdbBuffer[entryListPos + (uint64_t)e * ENTRY_SIZE];
+		memset(entry, 0, MAX_ENTRY_NAME);
+		snprintf((char*)entry, MAX_ENTRY_NAME, "ENTRY%u", e);
+		uint32_t blockListPos = NUM_MAGIC_BYTES + sizeof(uint32_t);
+		for(int i = 0; i < 4; i++) entry[MAX_ENTRY_NAME + i] = (unsigned char)(blockListPos >> (i * BYTE));
+	}
+	memset(&kdbBuffer[entryListPos + (uint64_t)numEntries * ENTRY_SIZE], 0xFF, sizeof(uint32_t));
+
+	return kdbBuffer;
+}
+
+// benchKdbIndex(): name lookup latency of a linear scan over parsed entries and of KdbIndex, 10^3 to 10^6 entries.
+void benchKdbIndex()
+{
+	cout << endl << "kdb-index: lookup latency" << endl;
+	cout << setw(10) << "entries" << setw(16) << "build ms" << setw(18) << "linear ns/find" << setw(18) << "index ns/find" << endl;
+	for(uint32_t numEntries = 1000; numEntries <= 1000000; numEntries *= 10)
+	{
+		uint64_t bufferLen = 0;
+		unsigned char* kdbBuffer = makeEntryListBuffer(numEntries, bufferLen);
+		vector<LazyEntry> entryList = parseKDBLazy(kdbBuffer, bufferLen);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		KdbIndex index(kdbBuffer, bufferLen);
+		double buildSeconds = secondsSince(start);
+
+		// Same targets for both, spread over the list
+		const uint32_t numLinear = 200;
+		const uint32_t numIndexed = 1000000;
+		char target[MAX_ENTRY_NAME];
+		uint64_t found = 0;
+		start = chrono::steady_clock::now();
+		for(uint32_t i = 0; i < numLinear; i++)
+		{
+			snprintf(target, MAX_ENTRY_NAME, "ENTRY%u", (uint32_t)(((uint64_t)i * 2654435761u) % numEntries));
+			for(size_t k = 0; k < entryList.size(); k++)
+			{
+				if(entryList[k].getName() == target)
+				{
+					found += k;
+					break;
+				}
+			}
+		}
+		double linearSeconds = secondsSince(start);
+
+		vector<string> targets;
+		for(uint32_t i = 0; i < 1024; i++)
+		{
+			snprintf(target, MAX_ENTRY_NAME, "ENTRY%u", (uint32_t)(((uint64_t)i * 2654435761u) % numEntries));
+			targets.push_back(target);
+		}
+		start = chrono::steady_clock::now();
+		for(uint32_t i = 0; i < numIndexed; i++)
+		{
+			found += index.find(targets[i % targets.size()]);
+		}
+		double indexSeconds = secondsSince(start);
+
+		if(index.find(targets[5]) != atoi(targets[5].c_str() + 5) || index.find("MISSING") != -1)
+		{
+			cerr << "KdbIndex lookup failed" << endl;
+			exit(1);
+		}
+
+		cout << setw(10) << numEntries << setw(16) << buildSeconds * 1000 << setw(18) << linearSeconds * 1e9 / numLinear
+			<< setw(18) << indexSeconds * 1e9 / numIndexed << "   (" << found % 10 << ")" << endl;
+		delete [] kdbBuffer;
+	}
+}
+
+// gatherBytewise(): The previous parseKDB() gather, blocks pushed to a vector then copied a byte at a time.
+uint64_t gatherBytewise(const unsigned char* kdbBuffer, const int32_t blockListPos, unsigned char* data)
+{
+	vector<Block> blockList;
+	int32_t blockIndex = blockListPos;
+	while(checkForListEnd(kdbBuffer, blockIndex) == false)
+	{
+		Block newBlock;
+		newBlock.size = readLittleEndian<int16_t>(kdbBuffer, blockIndex);
+		newBlock.dataPos = readLittleEndian<int32_t>(kdbBuffer, (blockIndex + sizeof(int16_t)));
+		blockList.push_back(newBlock);
+		blockIndex += BLOCK_SIZE;
+	}
+
+	int32_t numBlocks = (int32_t)blockList.size();
+	int32_t readCount = 0;
+	for(int32_t i = 0; i < numBlocks; i++)
+	{
+		Block readBlock = blockList.at(i);
+		for(int32_t k = 0; k < readBlock.size; k++)
+		{
+			data[readCount] = kdbBuffer[readBlock.dataPos + k];
+			readCount++;
+		}
+	}
+
+	return readCount;
+}
+
+// benchKdbGather(): gather throughput for entries fragmented into thousands of small blocks.
+void benchKdbGather(const uint64_t storeMiB)
+{
+	const uint32_t entrySize = 1024 * 1024;
+	cout << endl << "kdb-gather: " << storeMiB << " MiB store of " << entrySize / 1024 << " KiB entries" << endl;
+	cout << setw(12) << "block size" << setw(12) << "blocks" << setw(18) << "bytewise MB/s" << setw(18) << "views MB/s" << endl;
+	for(uint16_t blockSize = 16; blockSize <= 4096; blockSize *= 4)
+	{
+		uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, entrySize, blockSize);
+		MappedFile file(BENCH_KDB_PATH);
+		KdbIndex index(file.getData(), file.getSize());
+		unsigned char* expected = new unsigned char[entrySize];
+		unsigned char* data = new unsigned char[entrySize];
+		vector<BlockView> views;
+		double mb = (double)numEntries * entrySize / (1024 * 1024);
+
+		// Fault the mapping in first so both paths read from memory
+		for(uint32_t e = 0; e < numEntries; e++)
+		{
+			readBlockViews(file.getData(), file.getSize(), index.getBlockListPos(e), views);
+			gatherBlockViews(views, data);
+		}
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(uint32_t e = 0; e < numEntries; e++)
+		{
+			gatherBytewise(file.getData(), (int32_t)index.getBlockListPos(e), expected);
+		}
+		double bytewiseSeconds = secondsSince(start);
+
+		start = chrono::steady_clock::now();
+		for(uint32_t e = 0; e < numEntries; e++)
+		{
+			readBlockViews(file.getData(), file.getSize(), index.getBlockListPos(e), views);
+			gatherBlockViews(views, data);
+		}
+		double viewSeconds = secondsSince(start);
+
+		if(memcmp(expected, data, entrySize) != 0)
+		{
+			cerr << "gatherBlockViews() differs from bytewise gather" << endl;
+			exit(1);
+		}
+		cout << setw(12) << blockSize << setw(12) << views.size() << setw(18) << mb / bytewiseSeconds << setw(18) << mb / viewSeconds << endl;
+
+		delete [] expected;
+		delete [] data;
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// benchKdbParallel(): parseKDB() throughput for 1..N threads, on many small and a few huge entries.
+void benchKdbParallel(const uint64_t storeMiB)
+{
+	unsigned int maxThreads = thread::hardware_concurrency();
+	if(maxThreads < 4)
+	{
+		maxThreads = 4;
+	}
+
+	const char* names[] = {"many-small", "few-huge"};
+	const uint32_t entrySizes[] = {4096, (uint32_t)(storeMiB * 1024 * 1024 / 4)};
+	const uint16_t blockSizes[] = {1024, 4096};
+	cout << endl << "kdb-parallel: " << storeMiB << " MiB stores (" << thread::hardware_concurrency() << " hardware threads)" << endl;
+	cout << setw(12) << "store" << setw(10) << "entries" << setw(10) << "threads" << setw(14) << "MB/s" << setw(10) << "speedup" << endl;
+	for(int d = 0; d < 2; d++)
+	{
+		uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, entrySizes[d], blockSizes[d]);
+		MappedFile file(BENCH_KDB_PATH);
+		double mb = (double)numEntries * entrySizes[d] / (1024 * 1024);
+		vector<Entry> serialList = parseKDB(file.getData(), file.getSize(), 1); // also faults the mapping in
+
+		double baseSeconds = 0;
+		for(unsigned int numThreads = 1; numThreads <= maxThreads; numThreads++)
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			vector<Entry> entryList = (numThreads == 1) ? parseKDB(file.getData(), file.getSize(), 1)
+				: parseKDBParallel(file.getData(), file.getSize(), numThreads);
+			double seconds = secondsSince(start);
+			if(numThreads == 1)
+			{
+				baseSeconds = seconds;
+			}
+
+			for(size_t i = 0; i < entryList.size(); i++)
+			{
+				if(entryList[i].name != serialList[i].name || entryList[i].size != serialList[i].size
+					|| memcmp(entryList[i].data, serialList[i].data, entryList[i].size) != 0)
+				{
+					cerr << "parseKDBParallel() differs from parseKDB() at entry " << i << endl;
+					exit(1);
+				}
+				delete [] entryList[i].data;
+			}
+			cout << setw(12) << names[d] << setw(10) << numEntries << setw(10) << numThreads << setw(14) << mb / seconds << setw(9) << baseSeconds / seconds << "x" << endl;
+		}
+
+		for(size_t i = 0; i < serialList.size(); i++)
+		{
+			delete [] serialList[i].data;
+		}
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// readWholeEntry(): Materializes the largest entry with KdbReader::readEntry() and sums it.
+void readWholeEntry()
+{
+	KdbReader kdbReader(BENCH_KDB_PATH);
+	unsigned char* data = new unsigned char[kdbReader.getEntry(0).size];
+	uint64_t length = kdbReader.readEntry(0, data);
+	sampleHeap();
+	uint64_t sum = 0;
+	for(uint64_t i = 0; i < length; i++)
+	{
+		sum += data[i];
+	}
+	delete [] data;
+	stepSink = sum;
+}
+
+// streamWholeEntry(): Streams the largest entry with streamEntry() and sums it.
+void streamWholeEntry()
+{
+	KdbReader kdbReader(BENCH_KDB_PATH);
+	uint64_t sum = 0;
+	uint64_t numChunks = 0;
+	streamEntry(kdbReader.getFile().getData(), kdbReader.getFile().getSize(), kdbReader.getEntry(0).blockListPos, [&sum, &numChunks](const unsigned char* chunk, size_t length) {
+		if(numChunks++ % 1024 == 0)
+		{
+			sampleHeap();
+		}
+		for(size_t i = 0; i < length; i++)
+		{
+			sum += chunk[i];
+		}
+		return true;
+	});
+	stepSink = sum;
+}
+
+// benchKdbStream(): time and memory to consume one huge entry, materialized against streamed. Both paths
+// touch every mapped page of the store, so peak RSS holds the entry once for either, and the heap column
+// shows what each path allocates: the whole entry for readEntry(), one chunk for streamEntry().
+void benchKdbStream(const uint64_t entryMiB)
+{
+	writeSyntheticKDB(BENCH_KDB_PATH, entryMiB * 1024 * 1024, (uint32_t)(entryMiB * 1024 * 1024), 4096);
+
+	// Check streamed chunks match the materialized entry, with a chunk size that splits blocks
+	KdbReader kdbReader(BENCH_KDB_PATH);
+	unsigned char* data = new unsigned char[kdbReader.getEntry(0).size];
+	kdbReader.readEntry(0, data);
+	uint64_t position = 0;
+	bool matches = true;
+	streamEntry(kdbReader.getFile().getData(), kdbReader.getFile().getSize(), kdbReader.getEntry(0).blockListPos, [&](const unsigned char* chunk, size_t length) {
+		matches = matches && (memcmp(chunk, &data[position], length) == 0);
+		position += length;
+		return true;
+	}, 10007);
+	delete [] data;
+	if(matches == false || position != kdbReader.getEntry(0).size)
+	{
+		cerr << "streamEntry() differs from readEntry()" << endl;
+		exit(1);
+	}
+
+	cout << endl << "kdb-stream: one " << entryMiB << " MiB entry, " << STREAM_CHUNK_SIZE / 1024 << " KiB chunks" << endl;
+	cout << setw(24) << "path" << setw(14) << "seconds" << setw(16) << "peak RSS MiB" << setw(14) << "heap KiB" << endl;
+	double seconds = 0;
+	long heapKiB = 0;
+	long rss = runInChild(readWholeEntry, seconds, heapKiB);
+	cout << setw(24) << "readEntry" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+	long entryHeapKiB = heapKiB;
+	rss = runInChild(streamWholeEntry, seconds, heapKiB);
+	cout << setw(24) << "streamEntry" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+	if(entryMiB >= 16 && (heapKiB * 4 > entryHeapKiB || (uint64_t)entryHeapKiB < entryMiB * 1024))
+	{
+		cerr << "streamEntry() heap is not bounded below the whole entry" << endl;
+		exit(1);
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// sameEntries(): Checks two entry lists hold the same names and data.
+bool sameEntries(const vector<Entry> &a, const vector<Entry> &b)
+{
+	if(a.size() != b.size())
+	{
+		return false;
+	}
+	for(size_t i = 0; i < a.size(); i++)
+	{
+		if(a[i].name != b[i].name || a[i].size != b[i].size || memcmp(a[i].data, b[i].data, a[i].size) != 0)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+// freeEntries(): Releases the data of every entry in a list.
+void freeEntries(vector<Entry> &entryList)
+{
+	for(size_t i = 0; i < entryList.size(); i++)
+	{
+		delete [] entryList[i].data;
+	}
+	entryList.clear();
+}
+
+// benchKdbCompact(): KdbWriter round trip, then gather throughput on a fragmented store before and after compactKDB().
+void benchKdbCompact(const uint64_t storeMiB)
+{
+	const string compactPath = BENCH_KDB_PATH + ".compact";
+
+	// Round trip: plain entries (empty, sub-block, multi-block, 16 character name) written and parsed back
+	const uint64_t sizes[] = {0, 1, 100, MAX_BLOCK_DATA, MAX_BLOCK_DATA + 1, 3 * STREAM_CHUNK_SIZE + 5};
+	const char* names[] = {"EMPTY", "ONE", "SMALL", "ONEBLOCK", "TWOBLOCKS", "SIXTEENCHARNAME!"};
+	vector<vector<unsigned char> > plain(6);
+	KdbWriter kdbWriter(BENCH_KDB_PATH, BENCH_MAGIC_BYTES);
+	for(int e = 0; e < 6; e++)
+	{
+		for(uint64_t k = 0; k < sizes[e]; k++)
+		{
+			plain[e].push_back((unsigned char)(k * 7 + e));
+		}
+		kdbWriter.addEntry(names[e], plain[e].data(), sizes[e]);
+	}
+	bool roundTrip = kdbWriter.close();
+	{
+		KdbReader kdbReader(BENCH_KDB_PATH);
+		for(int e = 0; e < 6 && roundTrip == true; e++)
+		{
+			int64_t index = kdbReader.findEntry(names[e]);
+			vector<unsigned char> data(sizes[e] + 1);
+			roundTrip = (index == e && kdbReader.getEntry(e).size == sizes[e] && kdbReader.getEntry(e).numBlocks == (sizes[e] + MAX_BLOCK_DATA - 1) / MAX_BLOCK_DATA
+				&& kdbReader.readEntry(e, data.data()) == sizes[e] && memcmp(data.data(), plain[e].data(), sizes[e]) == 0);
+		}
+	}
+	if(roundTrip == false)
+	{
+		cerr << "KdbWriter round trip failed" << endl;
+		exit(1);
+	}
+
+	cout << endl << "kdb-compact: " << storeMiB << " MiB store of 1024 KiB entries" << endl;
+	cout << setw(12) << "block size" << setw(14) << "compact s" << setw(24) << "fragmented gather MB/s" << setw(24) << "compacted gather MB/s" << endl;
+	for(uint16_t blockSize = 64; blockSize <= 4096; blockSize *= 4)
+	{
+		uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, 1024 * 1024, blockSize);
+		double mb = (double)numEntries;
+		MappedFile file(BENCH_KDB_PATH);
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		KdbError error;
+		if(compactKDB(file.getData(), file.getSize(), compactPath, error) == false)
+		{
+			cerr << "compactKDB() failed" << endl;
+			exit(1);
+		}
+		double compactSeconds = secondsSince(start);
+		MappedFile compactFile(compactPath);
+
+		// Both files read once first so each parse reads from memory
+		vector<Entry> expected = parseKDB(file.getData(), file.getSize());
+		vector<Entry> compacted = parseKDB(compactFile.getData(), compactFile.getSize());
+		if(sameEntries(expected, compacted) == false)
+		{
+			cerr << "compacted store differs from source" << endl;
+			exit(1);
+		}
+		freeEntries(expected);
+		freeEntries(compacted);
+
+		// Gather every entry's (still encrypted) data, the part of a read compaction changes
+		double gatherSeconds[2] = {0, 0};
+		const MappedFile* files[2] = {&file, &compactFile};
+		vector<BlockView> views;
+		vector<unsigned char> data(1024 * 1024);
+		for(int f = 0; f < 2; f++)
+		{
+			KdbIndex index(files[f]->getData(), files[f]->getSize());
+			start = chrono::steady_clock::now();
+			for(uint32_t e = 0; e < numEntries; e++)
+			{
+				readBlockViews(files[f]->getData(), files[f]->getSize(), index.getBlockListPos(e), views);
+				gatherBlockViews(views, data.data());
+			}
+			gatherSeconds[f] = secondsSince(start);
+		}
+
+		cout << setw(12) << blockSize << setw(14) << compactSeconds << setw(24) << mb / gatherSeconds[0] << setw(24) << mb / gatherSeconds[1] << endl;
+	}
+	remove(BENCH_KDB_PATH.c_str());
+	remove(compactPath.c_str());
+}
+
+// benchKdbAppend(): appendKDB() time per entry on stores of growing size, against rewriting the store.
+void benchKdbAppend(const uint64_t storeMiB)
+{
+	const uint32_t numAppends = 1000;
+	const uint32_t appendSize = 4096;
+	vector<unsigned char> plain(appendSize);
+	vector<unsigned char> data(appendSize);
+	cout << endl << "kdb-append: " << numAppends << " appends of " << appendSize / 1024 << " KiB entries" << endl;
+	cout << setw(12) << "store MiB" << setw(16) << "append us" << setw(16) << "rewrite s" << endl;
+	for(uint64_t mib = storeMiB; mib <= storeMiB * 4; mib *= 2)
+	{
+		uint32_t numEntries = writeSyntheticKDB(BENCH_KDB_PATH, mib * 1024 * 1024, 1024 * 1024, 4096);
+
+		// Rewrite baseline, what adding an entry cost before
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		{
+			MappedFile file(BENCH_KDB_PATH);
+			KdbError error;
+			compactKDB(file.getData(), file.getSize(), BENCH_KDB_PATH + ".rewrite", error);
+		}
+		double rewriteSeconds = secondsSince(start);
+		remove((BENCH_KDB_PATH + ".rewrite").c_str());
+
+		start = chrono::steady_clock::now();
+		for(uint32_t a = 0; a < numAppends; a++)
+		{
+			char name[MAX_ENTRY_NAME] = {0};
+			snprintf(name, MAX_ENTRY_NAME, "APPEND%u", a);
+			for(uint32_t k = 0; k < appendSize; k++)
+			{
+				plain[k] = (unsigned char)(a + k * 3);
+			}
+			if(appendKDB(BENCH_KDB_PATH, name, plain.data(), (a % 10 == 0) ? 0 : appendSize) == false)
+			{
+				cerr << "appendKDB() failed" << endl;
+				exit(1);
+			}
+		}
+		double appendSeconds = secondsSince(start);
+
+		// Every appended entry reads back, and parseKDB() sees the original entries first
+		KdbReader kdbReader(BENCH_KDB_PATH);
+		bool matches = (kdbReader.getNumEntries() == numEntries + numAppends);
+		for(uint32_t a = 0; a < numAppends && matches == true; a++)
+		{
+			char name[MAX_ENTRY_NAME] = {0};
+			snprintf(name, MAX_ENTRY_NAME, "APPEND%u", a);
+			int64_t index = kdbReader.findEntry(name);
+			uint64_t size = (a % 10 == 0) ? 0 : appendSize;
+			for(uint32_t k = 0; k < appendSize; k++)
+			{
+				plain[k] = (unsigned char)(a + k * 3);
+			}
+			matches = (index == numEntries + a && kdbReader.readEntry(index, data.data()) == size && memcmp(data.data(), plain.data(), size) == 0);
+		}
+		vector<Entry> entryList = parseKDB(kdbReader.getFile().getData(), kdbReader.getFile().getSize());
+		matches = matches && entryList.size() == numEntries + numAppends && entryList[0].name == "ENTRY0" && entryList[numEntries].name == "APPEND0";
+		freeEntries(entryList);
+		if(matches == false)
+		{
+			cerr << "appended entries do not read back" << endl;
+			exit(1);
+		}
+
+		cout << setw(12) << mib << setw(16) << appendSeconds * 1e6 / numAppends << setw(16) << rewriteSeconds << endl;
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// writeLittleEndianAt(): Overwrites an integer in a buffer in little endian order, for corrupting test stores.
+template<class T>
+void writeLittleEndianAt(vector<unsigned char> &buffer, const uint64_t pos, const T value)
+{
+	for(int i = 0; i < (int)sizeof(T); i++)
+	{
+		buffer[pos + i] = (unsigned char)((value >> (i * BYTE)) & 0xFF);
+	}
+}
+
+// checkMalformedStores(): validateKDB() reports each kind of damage to a small store, and never reads out of bounds.
+void checkMalformedStores()
+{
+	// Three entries: 100 bytes, two blocks, 10 bytes
+	vector<unsigned char> plain(40000, 0x5A);
+	{
+		KdbWriter kdbWriter(BENCH_KDB_PATH, BENCH_MAGIC_BYTES);
+		kdbWriter.addEntry("A", plain.data(), 100);
+		kdbWriter.addEntry("B", plain.data(), 40000);
+		kdbWriter.addEntry("C", plain.data(), 10);
+	}
+	MappedFile file(BENCH_KDB_PATH);
+	const vector<unsigned char> good(file.getData(), file.getData() + file.getSize());
+	file.close();
+	remove(BENCH_KDB_PATH.c_str());
+	const uint64_t len = good.size();
+	const uint64_t entryListPos = readOffset(good.data(), NUM_MAGIC_BYTES);
+	const uint64_t listA = readOffset(good.data(), entryListPos + MAX_ENTRY_NAME);
+
+	struct Case { const char* name; KdbErrorCode expected; vector<unsigned char> kdb; };
+	vector<Case> cases;
+	cases.push_back({"well formed", KDB_OK, good});
+	cases.push_back({"short header", KDB_TRUNCATED_HEADER, vector<unsigned char>(good.begin(), good.begin() + 5)});
+	cases.push_back({"no entry list terminator", KDB_ENTRY_LIST_OUT_OF_BOUNDS, vector<unsigned char>(good.begin(), good.end() - 4)});
+	cases.push_back({"entry list past end", KDB_ENTRY_LIST_OUT_OF_BOUNDS, good});
+	writeLittleEndianAt<uint32_t>(cases.back().kdb, NUM_MAGIC_BYTES, (uint32_t)len);
+	cases.push_back({"block list past end", KDB_BLOCK_LIST_OUT_OF_BOUNDS, good});
+	writeLittleEndianAt<uint32_t>(cases.back().kdb, entryListPos + ENTRY_SIZE + MAX_ENTRY_NAME, (uint32_t)len - 2);
+	cases.push_back({"negative block size", KDB_BAD_BLOCK_SIZE, good});
+	writeLittleEndianAt<uint16_t>(cases.back().kdb, listA, 0x8000);
+	cases.push_back({"block data past end", KDB_BLOCK_DATA_OUT_OF_BOUNDS, good});
+	writeLittleEndianAt<uint32_t>(cases.back().kdb, listA + sizeof(int16_t), (uint32_t)len - 50);
+	cases.push_back({"shared block list", KDB_OVERLAP, good});
+	writeLittleEndianAt<uint32_t>(cases.back().kdb, entryListPos + ENTRY_SIZE + MAX_ENTRY_NAME, (uint32_t)listA);
+	cases.push_back({"data over entry list", KDB_OVERLAP, good});
+	writeLittleEndianAt<uint32_t>(cases.back().kdb, listA + sizeof(int16_t), (uint32_t)entryListPos - 50);
+
+	// Every entry pointing at one long block list, a quadratic walk without the list length bound
+	vector<unsigned char> shared(NUM_MAGIC_BYTES + sizeof(uint32_t), 0);
+	const uint32_t numShared = 100000;
+	for(uint32_t b = 0; b < numShared; b++)
+	{
+		pushLittleEndian<int16_t>(shared, 0);
+		pushLittleEndian<uint32_t>(shared, 0);
+	}
+	pushLittleEndian<uint32_t>(shared, (uint32_t)LIST_TERMINATOR);
+	writeLittleEndianAt<uint32_t>(shared, NUM_MAGIC_BYTES, (uint32_t)shared.size());
+	for(uint32_t e = 0; e < numShared / 4; e++)
+	{
+		shared.insert(shared.end(), MAX_ENTRY_NAME, 'S');
+		pushLittleEndian<uint32_t>(shared, NUM_MAGIC_BYTES + sizeof(uint32_t));
+	}
+	pushLittleEndian<uint32_t>(shared, (uint32_t)LIST_TERMINATOR);
+	cases.push_back({"entries share a long list", KDB_OVERLAP, shared});
+
+	cout << endl << "kdb-validate: malformed stores" << endl;
+	for(size_t c = 0; c < cases.size(); c++)
+	{
+		// Copy to an exact size heap buffer, so reads past the end are caught by memory checkers
+		unsigned char* kdbBuffer = new unsigned char[cases[c].kdb.size()];
+		memcpy(kdbBuffer, cases[c].kdb.data(), cases[c].kdb.size());
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		KdbError error = validateKDB(kdbBuffer, cases[c].kdb.size());
+		double seconds = secondsSince(start);
+		delete [] kdbBuffer;
+
+		cout << setw(28) << cases[c].name << setw(28) << getKdbErrorName(error.code) << setw(10) << error.position << setw(6) << error.entry
+			<< setw(12) << seconds * 1000 << " ms" << endl;
+		if(error.code != cases[c].expected)
+		{
+			cerr << "validateKDB() expected " << getKdbErrorName(cases[c].expected) << endl;
+			exit(1);
+		}
+	}
+
+	// Name filling all 16 bytes, well formed, but its string must stop before the block list position
+	vector<unsigned char> longName(good);
+	memset(&longName[entryListPos], 'N', MAX_ENTRY_NAME);
+	for(unsigned int numThreads = 1; numThreads <= 2; numThreads++)
+	{
+		KdbError error;
+		vector<Entry> entryList = parseKDBChecked(longName.data(), longName.size(), error, numThreads);
+		bool nameOk = (error.code == KDB_OK && entryList.empty() == false && entryList[0].name == string(MAX_ENTRY_NAME, 'N'));
+		freeEntries(entryList);
+		if(nameOk == false)
+		{
+			cerr << "parseKDBChecked() misread a 16 byte name (" << numThreads << " threads)" << endl;
+			exit(1);
+		}
+	}
+	cout << setw(28) << "16 byte name" << setw(28) << "ok" << endl;
+
+	// Random corruption: anything validated must parse, and nothing may crash
+	srand(2018);
+	uint32_t numValid = 0;
+	for(int trial = 0; trial < 20000; trial++)
+	{
+		vector<unsigned char> kdb(good.begin(), good.end());
+		for(int k = 0; k < 1 + trial % 4; k++)
+		{
+			uint64_t pos = (k == 0 && trial % 2 == 0) ? (entryListPos + rand() % (len - entryListPos)) : (uint64_t)rand() % len;
+			kdb[pos] = (unsigned char)rand();
+		}
+		KdbError error;
+		vector<Entry> entryList = parseKDBChecked(kdb.data(), kdb.size(), error);
+		numValid += (error.code == KDB_OK) ? 1 : 0;
+		freeEntries(entryList);
+	}
+	cout << setw(28) << "random corruption" << setw(28) << numValid << " of 20000 still valid, all parsed" << endl;
+}
+
+// benchKdbValidate(): validateKDB() cost against the trusting parseKDB() it guards.
+void benchKdbValidate(const uint64_t storeMiB)
+{
+	checkMalformedStores();
+
+	cout << endl << "kdb-validate: " << storeMiB << " MiB store of 1024 KiB entries" << endl;
+	cout << setw(12) << "block size" << setw(14) << "parse ms" << setw(18) << "validate ms" << setw(22) << "validate+overlap ms" << setw(16) << "overhead" << endl;
+	for(uint16_t blockSize = 64; blockSize <= 4096; blockSize *= 8)
+	{
+		writeSyntheticKDB(BENCH_KDB_PATH, storeMiB * 1024 * 1024, 1024 * 1024, blockSize);
+		MappedFile file(BENCH_KDB_PATH);
+		vector<Entry> entryList = parseKDB(file.getData(), file.getSize()); // faults the mapping in
+		freeEntries(entryList);
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		entryList = parseKDB(file.getData(), file.getSize());
+		double parseSeconds = secondsSince(start);
+		freeEntries(entryList);
+
+		start = chrono::steady_clock::now();
+		KdbError error = validateKDB(file.getData(), file.getSize(), false);
+		double boundsSeconds = secondsSince(start);
+		start = chrono::steady_clock::now();
+		error = validateKDB(file.getData(), file.getSize(), true);
+		double fullSeconds = secondsSince(start);
+		if(error.code != KDB_OK)
+		{
+			cerr << "validateKDB() rejected a well formed store: " << getKdbErrorName(error.code) << endl;
+			exit(1);
+		}
+
+		cout << setw(12) << blockSize << setw(14) << parseSeconds * 1000 << setw(18) << boundsSeconds * 1000 << setw(22) << fullSeconds * 1000
+			<< setw(15) << 100 * fullSeconds / parseSeconds << "%" << endl;
+	}
+	remove(BENCH_KDB_PATH.c_str());
+}
+
+// readLittleEndianBytewise(): The previous readLittleEndian(), assembling a byte at a time.
+template<class T>
+T readLittleEndianBytewise(const unsigned char* buffer, const int32_t startPos)
+{
+	T value = 0;
+	for(int i = 0; i < (int)sizeof(T); i++)
+	{
+		value += (T)((uint64_t)buffer[startPos + i] << (i * BYTE));
+	}
+	return value;
+}
+
+// walkBlockListBytewise(): The previous block list walk, bytewise reads and a rebuilt 32 bit value per terminator check.
+uint64_t walkBlockListBytewise(const unsigned char* kdbBuffer, const uint64_t blockListPos, vector<Block> &blockList)
+{
+	uint64_t totalDataSize = 0;
+	blockList.clear();
+	for(int32_t blockIndex = (int32_t)blockListPos; ; blockIndex += BLOCK_SIZE)
+	{
+		uint32_t nextBufferValue = 0;
+		for(int32_t i = (int32_t)sizeof(int32_t) - 1; i >= 0; i--)
+		{
+			nextBufferValue += (uint32_t)kdbBuffer[blockIndex + i] << (BYTE * i);
+		}
+		if(nextBufferValue == (uint32_t)LIST_TERMINATOR)
+		{
+			break;
+		}
+		Block newBlock;
+		newBlock.size = readLittleEndianBytewise<int16_t>(kdbBuffer, blockIndex);
+		newBlock.dataPos = readLittleEndianBytewise<int32_t>(kdbBuffer, blockIndex + sizeof(int16_t));
+		blockList.push_back(newBlock);
+		totalDataSize += newBlock.size;
+	}
+	return totalDataSize;
+}
+
+// walkBlockListNative(): The same walk as walkBlockListBytewise(), reading each field with one native load.
+uint64_t walkBlockListNative(const unsigned char* kdbBuffer, const uint64_t blockListPos, vector<Block> &blockList)
+{
+	uint64_t totalDataSize = 0;
+	blockList.clear();
+	for(uint64_t blockIndex = blockListPos; readOffset(kdbBuffer, blockIndex) != (uint32_t)LIST_TERMINATOR; blockIndex += BLOCK_SIZE)
+	{
+		Block newBlock;
+		newBlock.size = readLittleEndian<int16_t>(kdbBuffer, (int32_t)blockIndex);
+		newBlock.dataPos = readLittleEndian<int32_t>(kdbBuffer, (int32_t)(blockIndex + sizeof(int16_t)));
+		blockList.push_back(newBlock);
+		totalDataSize += newBlock.size;
+	}
+	return totalDataSize;
+}
+
+// benchKdbTable(): block list walk rate, bytewise reads against native loads, and the bounded readBlockViews() walk.
+void benchKdbTable(const uint64_t millionRecords)
+{
+	cout << endl << "kdb-table: " << millionRecords << " million block records" << endl;
+	cout << setw(14) << "list length" << setw(18) << "bytewise M/s" << setw(18) << "native M/s" << setw(18) << "views M/s" << endl;
+	const uint64_t numRecords = millionRecords * 1000000;
+	const uint64_t listLengths[] = {3, 100, numRecords};
+	for(int l = 0; l < 3; l++)
+	{
+		// Lists back to back, each followed by its terminator
+		uint64_t numLists = numRecords / listLengths[l];
+		vector<unsigned char> buffer;
+		buffer.reserve(numLists * (listLengths[l] * BLOCK_SIZE + sizeof(uint32_t)));
+		vector<uint64_t> listPos(numLists);
+		srand(17);
+		for(uint64_t list = 0; list < numLists; list++)
+		{
+			listPos[list] = buffer.size();
+			for(uint64_t r = 0; r < listLengths[l]; r++)
+			{
+				pushLittleEndian<int16_t>(buffer, (int16_t)(rand() % 32768));
+				pushLittleEndian<uint32_t>(buffer, (uint32_t)(rand() % 1024)); // data within the buffer, as the bounded walks require
+			}
+			pushLittleEndian<uint32_t>(buffer, (uint32_t)LIST_TERMINATOR);
+		}
+
+		uint64_t sums[3] = {0, 0, 0};
+		uint64_t counts[3] = {0, 0, 0};
+		double seconds[3] = {0, 0, 0};
+		vector<Block> blockList;
+		vector<BlockView> views;
+		for(int pass = 0; pass < 2; pass++) // first pass warms the buffer
+		{
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			for(uint64_t list = 0; list < numLists; list++)
+			{
+				sums[0] += walkBlockListBytewise(buffer.data(), listPos[list], blockList);
+				counts[0] += blockList.size();
+			}
+			seconds[0] = secondsSince(start);
+
+			start = chrono::steady_clock::now();
+			for(uint64_t list = 0; list < numLists; list++)
+			{
+				sums[1] += walkBlockListNative(buffer.data(), listPos[list], blockList);
+				counts[1] += blockList.size();
+			}
+			seconds[1] = secondsSince(start);
+
+			start = chrono::steady_clock::now();
+			for(uint64_t list = 0; list < numLists; list++)
+			{
+				uint32_t numBlocks = 0;
+				sums[2] += readBlockViews(buffer.data(), buffer.size(), listPos[list], views, numBlocks);
+				counts[2] += numBlocks;
+			}
+			seconds[2] = secondsSince(start);
+		}
+
+		if(sums[0] != sums[1] || sums[0] != sums[2] || counts[0] != counts[1] || counts[0] != counts[2])
+		{
+			cerr << "block list walks disagree" << endl;
+			exit(1);
+		}
+		double millions = (double)counts[0] / 2 / 1e6;
+		cout << setw(14) << listLengths[l] << setw(18) << millions / seconds[0] << setw(18) << millions / seconds[1] << setw(18) << millions / seconds[2] << endl;
+	}
+}
+
+// makeCarveInput(): Random carve input with a jpeg (magic bytes, random body, terminator) every ~64 KiB.
+// Params:	uint64_t; input size
+//			vector<vector<unsigned char>>; magic bytes starting each jpeg, taken in turn
+//			unsigned int; one in this many random bytes is forced to 0xFF (jpeg data is rich in 0xFF)
+// Return:	vector<unsigned char>; input
+vector<unsigned char> makeCarveInput(const uint64_t size, const vector<vector<unsigned char>> &magics, const unsigned int ffEvery)
+{
+	vector<unsigned char> input(size);
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for(uint64_t i = 0; i < size; i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17; // xorshift
+		input[i] = (state % ffEvery == 0) ? 0xFF : (unsigned char)(state >> 24);
+	}
+	size_t m = 0;
+	for(uint64_t start = 1000; start + 70000 < size; start += 40000 + state % 50000)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		const vector<unsigned char> &magicBytes = magics[m];
+		m = (m + 1) % magics.size();
+		memcpy(&input[start], magicBytes.data(), magicBytes.size());
+		uint64_t end = start + magicBytes.size() + state % 20000;
+		input[end] = 0xFF;
+		input[end + 1] = 0xD9;
+	}
+	return input;
+}
+vector<unsigned char> makeCarveInput(const uint64_t size, const vector<unsigned char> &magicBytes, const unsigned int ffEvery)
+{
+	return makeCarveInput(size, vector<vector<unsigned char>>(1, magicBytes), ffEvery);
+}
+
+// sameSpans(): Compares two carve results, offsets, sizes and signatures.
+bool sameSpans(const vector<JpegSpan> &a, const vector<JpegSpan> &b)
+{
+	bool same = (a.size() == b.size());
+	for(size_t j = 0; j < a.size() && same == true; j++)
+	{
+		same = (a[j].offset == b[j].offset && a[j].size == b[j].size && a[j].signature == b[j].signature);
+	}
+	return same;
+}
+
+// benchCarveScan(): first pass of the carve (headers and terminators), bytewise loop against the pattern finders.
+void benchCarveScan(const uint64_t inputMiB)
+{
+	const unsigned char rareMagic[] = {0x4A, 0x46, 0x49, 0x46, 0x7E};
+	const unsigned char ffMagic[] = {0xFF, 0x00, 0xE0};
+	const vector<unsigned char> magics[] = {vector<unsigned char>(rareMagic, rareMagic + 5), vector<unsigned char>(ffMagic, ffMagic + 3)};
+	const unsigned int ffEvery[] = {256, 16};
+	cout << endl << "carve-scan: " << inputMiB << " MiB input, " << getPatternFinderName() << " finder" << endl;
+	cout << setw(14) << "magic" << setw(10) << "0xFF" << setw(10) << "jpegs" << setw(16) << "bytewise GB/s" << setw(16) << "memchr GB/s" << setw(16) << "default GB/s" << endl;
+	for(int m = 0; m < 2; m++)
+	{
+		for(int f = 0; f < 2; f++)
+		{
+			vector<unsigned char> input = makeCarveInput(inputMiB * 1024 * 1024, magics[m], ffEvery[f]);
+			double gb = (double)input.size() / 1e9;
+			vector<JpegSpan> spans[3];
+
+			chrono::steady_clock::time_point start = chrono::steady_clock::now();
+			scanJpegsBytewise(input.data(), input.size(), magics[m].data(), magics[m].size(), spans[0]);
+			double bytewiseSeconds = secondsSince(start);
+			start = chrono::steady_clock::now();
+			scanJpegs(input.data(), input.size(), magics[m].data(), magics[m].size(), spans[1], findPatternScalar);
+			double scalarSeconds = secondsSince(start);
+			start = chrono::steady_clock::now();
+			scanJpegs(input.data(), input.size(), magics[m].data(), magics[m].size(), spans[2]);
+			double defaultSeconds = secondsSince(start);
+
+			if(sameSpans(spans[1], spans[0]) == false || sameSpans(spans[2], spans[0]) == false)
+			{
+				cerr << "scanJpegs() differs from bytewise scan" << endl;
+				exit(1);
+			}
+			cout << setw(14) << (m == 0 ? "rare first" : "0xFF first") << setw(10) << "1/" + to_string(ffEvery[f]) << setw(10) << spans[0].size()
+				<< setw(16) << gb / bytewiseSeconds << setw(16) << gb / scalarSeconds << setw(16) << gb / defaultSeconds << endl;
+		}
+	}
+}
+
+// benchCarveMulti(): carving for many signatures, one Aho-Corasick pass against one scanJpegs() pass per signature.
+void benchCarveMulti(const uint64_t inputMiB)
+{
+	const size_t signatureCounts[] = {1, 4, 16, 32};
+	cout << endl << "carve-multi: " << inputMiB << " MiB input, 1/64 bytes 0xFF" << endl;
+	cout << setw(12) << "signatures" << setw(10) << "states" << setw(10) << "jpegs" << setw(18) << "per-sig GB/s" << setw(18) << "one pass GB/s" << endl;
+	uint64_t state = 0x2545F4914F6CDD1Dull;
+	for(int c = 0; c < 4; c++)
+	{
+		// Random signatures, 3 to 8 bytes
+		vector<Signature> signatures(signatureCounts[c]);
+		vector<vector<unsigned char>> magics;
+		for(size_t sig = 0; sig < signatures.size(); sig++)
+		{
+			state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+			signatures[sig].name = "MAGIC" + to_string(sig);
+			signatures[sig].pattern.resize(3 + state % 6);
+			for(size_t k = 0; k < signatures[sig].pattern.size(); k++)
+			{
+				signatures[sig].pattern[k] = (unsigned char)(state >> (8 * k));
+			}
+			magics.push_back(signatures[sig].pattern);
+		}
+		SignatureMatcher matcher(signatures);
+		vector<unsigned char> input = makeCarveInput(inputMiB * 1024 * 1024, magics, 64);
+		double gb = (double)input.size() / 1e9;
+
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		size_t separateCount = 0;
+		for(size_t sig = 0; sig < signatures.size(); sig++)
+		{
+			vector<JpegSpan> spans;
+			scanJpegs(input.data(), input.size(), signatures[sig].pattern.data(), signatures[sig].pattern.size(), spans);
+			separateCount += spans.size();
+		}
+		double separateSeconds = secondsSince(start);
+		vector<JpegSpan> spans;
+		start = chrono::steady_clock::now();
+		carveSignatures(input.data(), input.size(), matcher, spans);
+		double onePassSeconds = secondsSince(start);
+
+		// Check against the bytewise reference, and against scanJpegs() for a single signature
+		vector<JpegSpan> reference;
+		carveSignaturesBytewise(input.data(), input.size(), signatures, reference);
+		if(sameSpans(spans, reference) == false || (signatures.size() == 1 && separateCount != spans.size()))
+		{
+			cerr << "carveSignatures() differs from reference" << endl;
+			exit(1);
+		}
+		cout << setw(12) << signatures.size() << setw(10) << matcher.getNumStates() << setw(10) << spans.size()
+			<< setw(18) << gb / separateSeconds << setw(18) << gb / onePassSeconds << endl;
+	}
+}
+
+// makeBenchSignatures(): Three signatures of different lengths, one starting with 0xFF.
+vector<Signature> makeBenchSignatures()
+{
+	const unsigned char magicA[] = {0x4A, 0x46, 0x49, 0x46, 0x7E};
+	const unsigned char magicB[] = {0xFF, 0x00, 0xE0};
+	const unsigned char magicC[] = {0x89, 0x50, 0x4E, 0x47};
+	vector<Signature> signatures(3);
+	signatures[0].pattern.assign(magicA, magicA + 5);
+	signatures[1].pattern.assign(magicB, magicB + 3);
+	signatures[2].pattern.assign(magicC, magicC + 4);
+	return signatures;
+}
+
+// benchCarveParallel(): carveSignaturesParallel() throughput for 1..N threads, checked against carveSignatures().
+void benchCarveParallel(const uint64_t inputMiB)
+{
+	unsigned int maxThreads = thread::hardware_concurrency();
+	if(maxThreads < 4)
+	{
+		maxThreads = 4;
+	}
+
+	vector<Signature> signatures = makeBenchSignatures();
+	vector<vector<unsigned char>> magics;
+	for(size_t sig = 0; sig < signatures.size(); sig++)
+	{
+		magics.push_back(signatures[sig].pattern);
+	}
+	SignatureMatcher matcher(signatures);
+	vector<unsigned char> input = makeCarveInput(inputMiB * 1024 * 1024, magics, 64);
+	double gb = (double)input.size() / 1e9;
+
+	vector<JpegSpan> serialSpans;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	carveSignatures(input.data(), input.size(), matcher, serialSpans);
+	double baseSeconds = secondsSince(start);
+
+	cout << endl << "carve-parallel: " << inputMiB << " MiB input, 3 signatures (" << thread::hardware_concurrency() << " hardware threads)" << endl;
+	cout << setw(10) << "threads" << setw(10) << "jpegs" << setw(14) << "GB/s" << setw(10) << "speedup" << endl;
+	cout << setw(10) << "serial" << setw(10) << serialSpans.size() << setw(14) << gb / baseSeconds << setw(9) << 1.0 << "x" << endl;
+	for(unsigned int numThreads = 2; numThreads <= maxThreads; numThreads++)
+	{
+		vector<JpegSpan> spans;
+		start = chrono::steady_clock::now();
+		carveSignaturesParallel(input.data(), input.size(), matcher, spans, numThreads);
+		double seconds = secondsSince(start);
+		if(sameSpans(spans, serialSpans) == false)
+		{
+			cerr << "carveSignaturesParallel() differs from carveSignatures() with " << numThreads << " threads" << endl;
+			exit(1);
+		}
+		cout << setw(10) << numThreads << setw(10) << spans.size() << setw(14) << gb / seconds << setw(9) << baseSeconds / seconds << "x" << endl;
+	}
+
+	// Same input with every terminator broken, so each chunk's headers have no end: a chunk's searches must
+	// stop near its end rather than each reading to the end of the input
+	for(uint64_t i = 0; i + 1 < input.size(); i++)
+	{
+		if(input[i] == JPEG_TERMINATOR[0] && input[i + 1] == JPEG_TERMINATOR[1])
+		{
+			input[i + 1] = 0x00;
+		}
+	}
+	serialSpans.clear();
+	start = chrono::steady_clock::now();
+	carveSignatures(input.data(), input.size(), matcher, serialSpans);
+	baseSeconds = secondsSince(start);
+	vector<JpegSpan> spans;
+	start = chrono::steady_clock::now();
+	carveSignaturesParallel(input.data(), input.size(), matcher, spans, maxThreads);
+	double seconds = secondsSince(start);
+	if(sameSpans(spans, serialSpans) == false)
+	{
+		cerr << "carveSignaturesParallel() differs from carveSignatures() without terminators" << endl;
+		exit(1);
+	}
+	cout << setw(10) << "no ends" << setw(10) << spans.size() << setw(14) << gb / seconds << setw(9) << baseSeconds / seconds << "x" << endl;
+}
+
+// carveWholeInput(): Buffered carve, whole input read into memory then carved.
+void carveWholeInput()
+{
+	ifstream inputStream(BENCH_CARVE_PATH, ifstream::binary | ifstream::in);
+	inputStream.seekg(0, inputStream.end);
+	uint64_t length = (uint64_t)inputStream.tellg();
+	inputStream.seekg(0, inputStream.beg);
+	unsigned char* input = new unsigned char[length];
+	inputStream.read((char*)input, length);
+	vector<JpegSpan> spans;
+	carveSignatures(input, length, SignatureMatcher(makeBenchSignatures()), spans);
+	sampleHeap();
+	delete [] input;
+	stepSink = spans.size();
+}
+
+// streamWholeInput(): Streamed carve, input read through streamCarve()'s window.
+void streamWholeInput()
+{
+	ifstream inputStream(BENCH_CARVE_PATH, ifstream::binary | ifstream::in);
+	uint64_t count = 0;
+	JpegHandlers handlers;
+	handlers.begin = [](uint64_t, uint32_t) {};
+	handlers.data = [](const unsigned char*, size_t) {};
+	handlers.end = [&count](uint64_t) {
+		if(count++ % 256 == 0)
+		{
+			sampleHeap();
+		}
+	};
+	handlers.discard = []() {};
+	streamCarve(inputStream, SignatureMatcher(makeBenchSignatures()), handlers);
+	stepSink = count;
+}
+
+// benchCarveStream(): time and peak RSS of the buffered carve against streamCarve(), checked to find the same jpegs.
+void benchCarveStream(const uint64_t inputMiB)
+{
+	// Write input in pieces, so the parent stays small
+	vector<Signature> signatures = makeBenchSignatures();
+	vector<vector<unsigned char>> magics;
+	for(size_t sig = 0; sig < signatures.size(); sig++)
+	{
+		magics.push_back(signatures[sig].pattern);
+	}
+	SignatureMatcher matcher(signatures);
+	vector<JpegSpan> pieceSpans;
+	ofstream inputStream(BENCH_CARVE_PATH, ostream::binary | ostream::trunc);
+	const uint64_t pieceMiB = 64;
+	for(uint64_t written = 0; written < inputMiB; written += pieceMiB)
+	{
+		uint64_t mib = (inputMiB - written < pieceMiB) ? (inputMiB - written) : pieceMiB;
+		vector<unsigned char> piece = makeCarveInput(mib * 1024 * 1024, magics, 64);
+		size_t first = pieceSpans.size();
+		carveSignatures(piece.data(), piece.size(), matcher, pieceSpans); // pieces hold whole jpegs
+		for(size_t j = first; j < pieceSpans.size(); j++)
+		{
+			pieceSpans[j].offset += written * 1024 * 1024;
+		}
+		inputStream.write((const char*)piece.data(), piece.size());
+	}
+	inputStream.close();
+
+	// Check streamed spans and bytes, with a window that splits headers and terminators
+	ifstream checkStream(BENCH_CARVE_PATH, ifstream::binary | ifstream::in);
+	vector<JpegSpan> streamSpans;
+	uint64_t jpegBytes = 0;
+	JpegHandlers handlers;
+	handlers.begin = [&](uint64_t offset, uint32_t signature) {
+		JpegSpan newSpan;
+		newSpan.offset = offset;
+		newSpan.signature = signature;
+		streamSpans.push_back(newSpan);
+		jpegBytes = 0;
+	};
+	handlers.data = [&](const unsigned char*, size_t length) { jpegBytes += length; };
+	handlers.end = [&](uint64_t size) { streamSpans.back().size = (jpegBytes == size) ? size : 0; };
+	handlers.discard = [&]() { streamSpans.pop_back(); };
+	streamCarve(checkStream, matcher, handlers, 10007);
+	if(sameSpans(streamSpans, pieceSpans) == false)
+	{
+		cerr << "streamCarve() differs from carveSignatures()" << endl;
+		exit(1);
+	}
+
+	cout << endl << "carve-stream: " << inputMiB << " MiB input, " << streamSpans.size() << " jpegs, " << CARVE_WINDOW_SIZE / 1024 << " KiB window" << endl;
+	cout << setw(24) << "path" << setw(14) << "seconds" << setw(16) << "peak RSS MiB" << setw(14) << "heap KiB" << endl;
+	double seconds = 0;
+	long heapKiB = 0;
+	long rss = runInChild(carveWholeInput, seconds, heapKiB);
+	cout << setw(24) << "buffered" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+	rss = runInChild(streamWholeInput, seconds, heapKiB);
+	cout << setw(24) << "streamCarve" << setw(14) << seconds << setw(16) << rss / 1024 << setw(14) << heapKiB << endl;
+	remove(BENCH_CARVE_PATH.c_str());
+}
+
+// appendSegment(): Appends a marker segment with a random payload to a synthetic jpeg.
+void appendSegment(vector<unsigned char> &jpeg, const unsigned char marker, const uint16_t payloadLen, uint64_t &state)
+{
+	jpeg.push_back(JPEG_MARKER);
+	jpeg.push_back(marker);
+	jpeg.push_back((unsigned char)((payloadLen + 2) >> 8));
+	jpeg.push_back((unsigned char)(payloadLen + 2));
+	for(uint16_t i = 0; i < payloadLen; i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		jpeg.push_back((i % 97 == 5) ? JPEG_TERMINATOR[i % 2] : (unsigned char)(state >> 24)); // stray FF D9 in segment data
+	}
+}
+
+// makeStructuredJpeg(): Synthetic jpeg with real marker structure, its first 3 bytes replaced by magic bytes.
+// An APP1 segment holds a thumbnail with its own SOI and EOI, and entropy coded data has stuffed 0xFF bytes
+// and restart markers.
+// Return:	vector<unsigned char>; jpeg, EOI included
+vector<unsigned char> makeStructuredJpeg(const unsigned char* magicBytes, const uint64_t scanLen, uint64_t &state)
+{
+	vector<unsigned char> jpeg(magicBytes, magicBytes + JPEG_START_SIZE);
+	jpeg.push_back(0xE1); // APP1, its marker's 0xFF is the last repaired byte
+	uint16_t thumbnailLen = 2000;
+	jpeg.push_back((unsigned char)((thumbnailLen + 6) >> 8));
+	jpeg.push_back((unsigned char)(thumbnailLen + 6));
+	jpeg.push_back(JPEG_MARKER);
+	jpeg.push_back(JPEG_SOI);
+	for(uint16_t i = 0; i < thumbnailLen; i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		jpeg.push_back((unsigned char)(state >> 24));
+	}
+	jpeg.push_back(JPEG_MARKER);
+	jpeg.push_back(JPEG_EOI);
+	appendSegment(jpeg, 0xDB, 65, state);			// DQT
+	appendSegment(jpeg, 0xC0, 15, state);			// SOF0
+	appendSegment(jpeg, 0xC4, 400, state);			// DHT
+	appendSegment(jpeg, JPEG_SOS, 10, state);
+	jpeg[jpeg.size() - 10] = 3; // components in scan
+	for(uint64_t i = 0; i < scanLen; i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		unsigned char byte = (unsigned char)(state >> 24);
+		jpeg.push_back(byte);
+		if(byte == JPEG_MARKER)
+		{
+			jpeg.push_back(0x00);
+		}
+		else if(i % 4096 == 4095)
+		{
+			jpeg.push_back(JPEG_MARKER);
+			jpeg.push_back((unsigned char)(JPEG_RST0 + (i / 4096) % 8));
+		}
+	}
+	jpeg.push_back(JPEG_MARKER);
+	jpeg.push_back(JPEG_EOI);
+	return jpeg;
+}
+
+// benchCarveMarkers(): jpeg ends found by terminator scan against marker walks, on structured jpegs with
+// embedded thumbnails and false headers in the data between them.
+void benchCarveMarkers(const uint64_t inputMiB)
+{
+	const unsigned char magicBytes[] = {0x4A, 0x46, 0x7E};
+	vector<Signature> signatures(1);
+	signatures[0].pattern.assign(magicBytes, magicBytes + JPEG_START_SIZE);
+	signatures[0].repair.assign(JPEG_START, JPEG_START + JPEG_START_SIZE);
+	SignatureMatcher matcher(signatures);
+
+	// Jpegs separated by random data holding false headers
+	vector<unsigned char> input;
+	vector<JpegSpan> truth;
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	while(input.size() < inputMiB * 1024 * 1024)
+	{
+		for(int i = 0; i < 20000; i++)
+		{
+			state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+			input.push_back((i == 10000) ? magicBytes[0] : (i == 10001) ? magicBytes[1] : (i == 10002) ? magicBytes[2] : (unsigned char)(state >> 24));
+		}
+		vector<unsigned char> jpeg = makeStructuredJpeg(magicBytes, 50000 + state % 200000, state);
+		JpegSpan span;
+		span.offset = input.size();
+		span.size = jpeg.size();
+		span.signature = 0;
+		truth.push_back(span);
+		input.insert(input.end(), jpeg.begin(), jpeg.end());
+	}
+	double gb = (double)input.size() / 1e9;
+
+	const char* names[] = {"terminator", "terminator 1 MiB cap", "markers", "markers 1 MiB cap"};
+	cout << endl << "carve-markers: " << inputMiB << " MiB input, " << truth.size() << " jpegs, a false header before each" << endl;
+	cout << setw(24) << "jpeg end" << setw(10) << "carved" << setw(10) << "exact" << setw(14) << "GB/s" << endl;
+	vector<JpegSpan> serialSpans;
+	for(int m = 0; m < 4; m++)
+	{
+		CarveOptions options;
+		options.end = (m < 2) ? END_AT_TERMINATOR : END_BY_MARKERS;
+		options.maxSize = (m % 2 == 1) ? 1024 * 1024 : 0;
+		vector<JpegSpan> spans;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		carveSignatures(input.data(), input.size(), matcher, spans, options);
+		double seconds = secondsSince(start);
+
+		// Marker walks must also join across parallel chunks
+		vector<JpegSpan> parallelSpans;
+		carveSignaturesParallel(input.data(), input.size(), matcher, parallelSpans, 4, 1024 * 1024, options);
+		if(sameSpans(parallelSpans, spans) == false)
+		{
+			cerr << "carveSignaturesParallel() differs from carveSignatures() for " << names[m] << endl;
+			exit(1);
+		}
+		size_t exact = 0;
+		for(size_t j = 0, t = 0; j < spans.size(); j++)
+		{
+			while(t < truth.size() && truth[t].offset < spans[j].offset)
+			{
+				t++;
+			}
+			exact += (t < truth.size() && truth[t].offset == spans[j].offset && truth[t].size == spans[j].size) ? 1 : 0;
+		}
+		if(options.end == END_BY_MARKERS && (exact != truth.size() || spans.size() != truth.size()))
+		{
+			cerr << "marker walk missed jpeg ends" << endl;
+			exit(1);
+		}
+		cout << setw(24) << names[m] << setw(10) << spans.size() << setw(10) << exact << setw(14) << gb / seconds << endl;
+	}
+}
+
+// checkMd5Vectors(): Rfc 1321 test suite hashed serially and in lanes, messages split between head and body
+// at every point. Exits on the first wrong digest.
+void checkMd5Vectors()
+{
+	const char* messages[] = {"", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz",
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789",
+		"12345678901234567890123456789012345678901234567890123456789012345678901234567890"};
+	const char* digests[] = {"d41d8cd98f00b204e9800998ecf8427e", "0cc175b9c0f1b6a831c399e269772661",
+		"900150983cd24fb0d6963f7d28e17f72", "f96b697d7cb7938d525a2f31aaf161d0", "c3fcd3d76192e4007dfb496cca67e13b",
+		"d174ab98d277d9f5a5611c2c9f419d9f", "57edf4a22be3c955ac49da2e2107b67a"};
+	vector<Md5Job> jobs;
+	vector<const char*> expected;
+	for(int m = 0; m < 7; m++)
+	{
+		const unsigned char* message = (const unsigned char*)messages[m];
+		uint64_t length = strlen(messages[m]);
+		for(uint64_t split = 0; split <= length; split++)
+		{
+			jobs.push_back(Md5Job(message, split, message + split, length - split));
+			expected.push_back(digests[m]);
+		}
+	}
+	vector<Md5Job> serialJobs = jobs;
+	for(size_t j = 0; j < serialJobs.size(); j++)
+	{
+		hashMd5Scalar(serialJobs[j]);
+	}
+	hashMd5Jobs(jobs, 1);
+	for(size_t j = 0; j < jobs.size(); j++)
+	{
+		if(md5HexDigest(serialJobs[j].digest) != expected[j] || md5HexDigest(jobs[j].digest) != expected[j])
+		{
+			cerr << "md5 test vector " << j << " hashed wrong" << endl;
+			exit(1);
+		}
+	}
+}
+
+// benchMd5Lanes(): throughput of hashing jpegs one at a time against hashMd5Jobs(), for small and large jpegs
+// with a repaired 3 byte head each. Checked to give the same digests.
+void benchMd5Lanes(const uint64_t inputMiB)
+{
+	checkMd5Vectors();
+	unsigned int maxThreads = thread::hardware_concurrency();
+	if(maxThreads < 4)
+	{
+		maxThreads = 4;
+	}
+
+	vector<unsigned char> input(inputMiB * 1024 * 1024);
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for(size_t i = 0; i < input.size(); i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		input[i] = (unsigned char)(state >> 24);
+	}
+	double gb = (double)input.size() / 1e9;
+
+	cout << endl << "md5-lanes: " << inputMiB << " MiB of jpegs, " << getMd5LanesName() << " lanes (" << thread::hardware_concurrency() << " hardware threads)" << endl;
+	cout << setw(12) << "jpeg size" << setw(10) << "jpegs" << setw(10) << "threads" << setw(14) << "GB/s" << setw(10) << "speedup" << endl;
+	const uint64_t jpegSizes[] = {4 * 1024, 64 * 1024, 1024 * 1024, 0};
+	for(int s = 0; s < 4; s++)
+	{
+		// Jpegs of one size, or when 0 of random sizes up to 256 KiB
+		vector<Md5Job> jobs;
+		for(uint64_t offset = 0; offset < input.size(); )
+		{
+			state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+			uint64_t size = (jpegSizes[s] != 0) ? jpegSizes[s] : 1 + state % (256 * 1024);
+			size = (input.size() - offset < size) ? input.size() - offset : size;
+			jobs.push_back(Md5Job(JPEG_START, (size < JPEG_START_SIZE) ? size : JPEG_START_SIZE, input.data() + offset + JPEG_START_SIZE, (size < JPEG_START_SIZE) ? 0 : size - JPEG_START_SIZE));
+			offset += size;
+		}
+		string sizeName = (jpegSizes[s] != 0) ? to_string(jpegSizes[s] / 1024) + " KiB" : "mixed";
+
+		vector<Md5Job> serialJobs = jobs;
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		for(size_t j = 0; j < serialJobs.size(); j++)
+		{
+			hashMd5Scalar(serialJobs[j]);
+		}
+		double baseSeconds = secondsSince(start);
+		cout << setw(12) << sizeName << setw(10) << jobs.size() << setw(10) << "serial" << setw(14) << gb / baseSeconds << setw(9) << 1.0 << "x" << endl;
+		for(unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+		{
+			vector<Md5Job> laneJobs = jobs;
+			start = chrono::steady_clock::now();
+			hashMd5Jobs(laneJobs, numThreads);
+			double seconds = secondsSince(start);
+			for(size_t j = 0; j < laneJobs.size(); j++)
+			{
+				if(memcmp(laneJobs[j].digest, serialJobs[j].digest, MD5_DIGEST_SIZE) != 0)
+				{
+					cerr << "hashMd5Jobs() differs from hashMd5Scalar() with " << numThreads << " threads" << endl;
+					exit(1);
+				}
+			}
+			cout << setw(12) << sizeName << setw(10) << jobs.size() << setw(10) << numThreads << setw(14) << gb / seconds << setw(9) << baseSeconds / seconds << "x" << endl;
+		}
+	}
+}
+
+// checkContentSet(): Jpegs sharing a digest key (first 8 digest bytes) but not a whole md5 digest, or a digest
+// but not a size, must stay apart. Exits on the first failure.
+void checkContentSet()
+{
+	const unsigned char digestA[MD5_DIGEST_SIZE] = {1};
+	const unsigned char digestB[MD5_DIGEST_SIZE] = {1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 2};
+	ContentSet contentSet;
+	bool inserted[] = {contentSet.insert(10, digestA, 0), contentSet.insert(10, digestB, 1), contentSet.insert(10, digestA, 2), contentSet.insert(11, digestA, 3)};
+	vector<ContentGroup> groups = contentSet.getGroups();
+	if(inserted[0] == false || inserted[1] == false || inserted[2] == true || inserted[3] == false
+		|| groups.size() != 3 || groups[0].members.size() != 2 || groups[0].members[1] != 2)
+	{
+		cerr << "ContentSet grouped colliding digest keys wrong" << endl;
+		exit(1);
+	}
+}
+
+// benchJpegDedup(): throughput of groupMd5Jobs() against md5 lanes alone, over jpegs each repeated many times,
+// checked to find every distinct jpeg once.
+void benchJpegDedup(const uint64_t inputMiB)
+{
+	checkContentSet();
+	unsigned int maxThreads = thread::hardware_concurrency();
+	if(maxThreads < 4)
+	{
+		maxThreads = 4;
+	}
+
+	// 64 KiB jpegs, 1 in 16 unique and the rest repeats of 64 common ones (fewer on small inputs, so most
+	// of the input is left for jpegs)
+	const uint64_t jpegSize = 64 * 1024;
+	vector<unsigned char> input(inputMiB * 1024 * 1024);
+	const size_t numCommon = (input.size() / jpegSize / 4 < 64) ? (size_t)(input.size() / jpegSize / 4) : 64;
+	if(numCommon == 0)
+	{
+		cerr << "jpeg-dedup needs at least 1 MiB of input" << endl;
+		exit(1);
+	}
+	uint64_t state = 0x9E3779B97F4A7C15ull;
+	for(size_t i = 0; i < input.size(); i++)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		input[i] = (unsigned char)(state >> 24);
+	}
+	vector<Md5Job> jobs;
+	vector<bool> commonUsed(numCommon, false);
+	size_t numUnique = 0;
+	for(uint64_t offset = numCommon * jpegSize; offset + jpegSize <= input.size(); offset += jpegSize)
+	{
+		state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+		if(state % 16 == 0)
+		{
+			numUnique++;
+		}
+		else
+		{
+			numUnique += (commonUsed[state % numCommon] == false) ? 1 : 0;
+			commonUsed[state % numCommon] = true;
+			memcpy(input.data() + offset, input.data() + (state % numCommon) * jpegSize, jpegSize);
+		}
+		jobs.push_back(Md5Job(JPEG_START, JPEG_START_SIZE, input.data() + offset + JPEG_START_SIZE, jpegSize - JPEG_START_SIZE));
+	}
+	double gb = (double)(jobs.size() * jpegSize) / 1e9;
+
+	cout << endl << "jpeg-dedup: " << inputMiB << " MiB input, " << jobs.size() << " jpegs of 64 KiB, " << numUnique << " distinct" << endl;
+	cout << setw(24) << "stage" << setw(10) << "threads" << setw(10) << "groups" << setw(14) << "GB/s" << endl;
+	vector<Md5Job> md5Jobs = jobs;
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	hashMd5Jobs(md5Jobs, 1);
+	cout << setw(24) << "md5 lanes" << setw(10) << 1 << setw(10) << "-" << setw(14) << gb / secondsSince(start) << endl;
+	for(unsigned int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+	{
+		vector<Md5Job> groupJobs = jobs;
+		ContentSet contentSet;
+		start = chrono::steady_clock::now();
+		groupMd5Jobs(groupJobs, numThreads, contentSet);
+		double seconds = secondsSince(start);
+		vector<ContentGroup> groups = contentSet.getGroups();
+		size_t members = 0;
+		for(size_t g = 0; g < groups.size(); g++)
+		{
+			members += groups[g].members.size();
+		}
+		if(groups.size() != numUnique || members != jobs.size())
+		{
+			cerr << "groupMd5Jobs() found " << groups.size() << " groups of " << members << " jpegs with " << numThreads << " threads" << endl;
+			exit(1);
+		}
+		cout << setw(24) << "md5 lanes + group" << setw(10) << numThreads << setw(10) << groups.size() << setw(14) << gb / seconds << endl;
+	}
+}
+
+/***********************/
+/********* Main ********/
+int main(int argc, char* argv[])
+{
+	string benchmark = (argc > 1) ? argv[1] : "all";
+	uint64_t sizeMiB = (argc > 2) ? strtoull(argv[2], NULL, 10) : 0;
+
+	if(benchmark == "kdb-open" || benchmark == "all")
+	{
+		benchKdbOpen((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "kdb-index" || benchmark == "all")
+	{
+		benchKdbIndex();
+	}
+	if(benchmark == "kdb-gather" || benchmark == "all")
+	{
+		benchKdbGather((sizeMiB != 0) ? sizeMiB : 128);
+	}
+	if(benchmark == "kdb-parallel" || benchmark == "all")
+	{
+		benchKdbParallel((sizeMiB != 0) ? sizeMiB : 128);
+	}
+	if(benchmark == "kdb-stream" || benchmark == "all")
+	{
+		benchKdbStream((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "kdb-compact" || benchmark == "all")
+	{
+		benchKdbCompact((sizeMiB != 0) ? sizeMiB : 128);
+	}
+	if(benchmark == "kdb-append" || benchmark == "all")
+	{
+		benchKdbAppend((sizeMiB != 0) ? sizeMiB : 64);
+	}
+	if(benchmark == "kdb-validate" || benchmark == "all")
+	{
+		benchKdbValidate((sizeMiB != 0) ? sizeMiB : 128);
+	}
+	if(benchmark == "kdb-table" || benchmark == "all")
+	{
+		benchKdbTable((sizeMiB != 0) ? sizeMiB : 8);
+	}
+	if(benchmark == "carve-scan" || benchmark == "all")
+	{
+		benchCarveScan((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "carve-multi" || benchmark == "all")
+	{
+		benchCarveMulti((sizeMiB != 0) ? sizeMiB : 64);
+	}
+	if(benchmark == "carve-parallel" || benchmark == "all")
+	{
+		benchCarveParallel((sizeMiB != 0) ? sizeMiB : 1024);
+	}
+	if(benchmark == "carve-stream" || benchmark == "all")
+	{
+		benchCarveStream((sizeMiB != 0) ? sizeMiB : 1024);
+	}
+	if(benchmark == "carve-markers" || benchmark == "all")
+	{
+		benchCarveMarkers((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "md5-lanes" || benchmark == "all")
+	{
+		benchMd5Lanes((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "jpeg-dedup" || benchmark == "all")
+	{
+		benchJpegDedup((sizeMiB != 0) ? sizeMiB : 256);
+	}
+	if(benchmark == "kdb-lookup" || benchmark == "all")
+	{
+		benchKdbLookup((sizeMiB != 0) ? sizeMiB : 256);
+	}
+
+	return 0;
+}
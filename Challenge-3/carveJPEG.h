@@ -0,0 +1,1151 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Finding obfuscated jpegs within a buffer, split out of repairJPEG.cpp so benchmarks can use it.
+// REFERENCES:
+// - Searching a buffer for a byte, Reference: http://www.cplusplus.com/reference/cstring/memchr/
+// - Substring search filtering candidates on first and last byte, Reference: http://0x80.pl/articles/simd-strfind.html
+// - AVX2 intrinsics, Reference: https://software.intel.com/sites/landingpage/IntrinsicsGuide/
+// - Aho-Corasick multi-pattern matching, Reference: https://cr.yp.to/bib/1975/aho.pdf
+
+#ifndef CARVEJPEG_H
+#define CARVEJPEG_H
+
+#include <cstring>
+#include <functional>
+#include <istream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "workStealingPool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CARVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+const unsigned char JPEG_START[] = {0xFF, 0xD8, 0xFF}; // Starting indicator bytes of a jpeg file
+const unsigned char JPEG_TERMINATOR[] = {0xFF, 0xD9}; // Terminating bytes of a jpeg file
+const int32_t JPEG_START_SIZE = 3;                    // Number of jpeg indicating bytes
+const int32_t JPEG_TERMINATOR_SIZE = 2;               // Number of jpeg terminating bytes
+const int MAX_SIMD_BYTE_SET = 8;                      // Most distinct first bytes skipped over with simd compares
+const uint64_t CARVE_CHUNK_SIZE = 8 * 1024 * 1024;    // Bytes of input carved per task by carveSignaturesParallel()
+const size_t CARVE_WINDOW_SIZE = 4 * 1024 * 1024;     // Default window size of streamCarve()
+const unsigned char JPEG_MARKER = 0xFF;               // Byte starting every jpeg marker
+const unsigned char JPEG_SOI = 0xD8;                  // Start of image marker
+const unsigned char JPEG_EOI = 0xD9;                  // End of image marker
+const unsigned char JPEG_SOS = 0xDA;                  // Start of scan marker, entropy coded data follows its segment
+const unsigned char JPEG_TEM = 0x01;                  // Standalone marker without a length
+const unsigned char JPEG_RST0 = 0xD0;                 // First restart marker, standalone, may appear within entropy coded data
+const unsigned char JPEG_RST7 = 0xD7;                 // Last restart marker
+const unsigned char JPEG_FIRST_SEGMENT = 0xC0;        // Lowest marker of a jpeg segment (SOFn, DHT, DQT, APPn...), lower ones are reserved
+const unsigned char JPEG_SOF0 = 0xC0;                 // First start of frame marker
+const unsigned char JPEG_SOF15 = 0xCF;                // Last start of frame marker, C4, C8 and CC within the range are not frames
+const unsigned char JPEG_DHT = 0xC4;                  // Huffman table marker
+const unsigned char JPEG_JPG = 0xC8;                  // Reserved extension marker
+const unsigned char JPEG_DAC = 0xCC;                  // Arithmetic coding table marker
+enum JpegEnd {
+	END_AT_TERMINATOR,		// Jpeg ends at the first JPEG_TERMINATOR after its header
+	END_BY_MARKERS			// Jpeg ends at the EOI marker reached by walking its marker segments
+};
+enum CarveStep {
+	CARVE_FOUND,			// Header and terminator found
+	CARVE_NO_HEADER,		// No header before the limit
+	CARVE_NO_TERMINATOR,	// Header found, but no terminator after it
+	CARVE_UNRESOLVED		// Header found, but its end may lie past where the search stopped
+};
+
+/***********************/
+/******* Structs *******/
+struct JpegSpan {
+	uint64_t offset;	// Offset of the jpeg's magic bytes within the input
+	uint64_t size;		// Length from the magic bytes through the terminator
+	uint32_t signature;	// Index of the signature that matched, 0 for single pattern scans
+};
+
+struct CarveChunk {
+	uint64_t start;					// First position of the chunk
+	uint64_t end;					// Position after the chunk, headers found start before it
+	vector<JpegSpan> spans;			// Jpegs whose headers start within the chunk
+	vector<uint64_t> searchStarts;	// Position the search finding each jpeg began at
+	uint64_t lastSearch;			// Position the final search began at
+	CarveStep lastStep;				// Outcome of the final search, CARVE_NO_HEADER, CARVE_NO_TERMINATOR or CARVE_UNRESOLVED
+	uint64_t openHeader;			// Header the final search found without a terminator, length if none
+};
+
+struct CarveOptions {
+	JpegEnd end;		// How each jpeg's end is found
+	uint64_t maxSize;	// Longest jpeg carved, headers of longer ones are skipped as false matches (0 for no limit)
+
+	CarveOptions()
+	{
+		end = END_AT_TERMINATOR;
+		maxSize = 0;
+	}
+};
+
+struct JpegHandlers {
+	function<void(uint64_t offset, uint32_t signature)> begin;		// Header found at an input offset
+	function<void(const unsigned char* data, size_t length)> data;	// Next bytes of the jpeg, header first
+	function<void(uint64_t size)> end;								// Terminator read, the jpeg is complete
+	function<void()> discard;										// Input ended without a terminator, drop the jpeg
+};
+
+struct Signature {
+	string name;					// Name of the kdb entry holding the signature
+	vector<unsigned char> pattern;	// Obfuscated magic bytes starting each file
+	vector<unsigned char> repair;	// Bytes written over the start of each file found
+};
+
+/***********************/
+/******* Parsing *******/
+// checkMatch(): compares two byte arrays for equivalent data.
+// Size assumed to be greater than zero, and less than or equal to the length of the smallest byte array.
+// Params:  unsigned char*; first byte array for comparison.
+//          unsigned char*; second byte array for comparison.
+//          size; number of bytes to compare.
+// Return: bool; flag if arrays have matching data. True for equivalent, false for not equivalent.
+bool checkMatch(const unsigned char* source, const unsigned char* match, const int32_t size)
+{
+	for(int i = 0; i < size; i++)
+	{
+		if(source[i] != match[i])
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// PatternFinder: Function returning the position of the first occurrence of a pattern within a buffer,
+// or the buffer length if there is none. Pattern length is at least one.
+typedef uint64_t (*PatternFinder)(const unsigned char* buffer, uint64_t length, const unsigned char* pattern, size_t patternLen);
+
+// findPatternScalar(): Portable pattern finder, memchr for the first byte then a compare of the rest.
+uint64_t findPatternScalar(const unsigned char* buffer, uint64_t length, const unsigned char* pattern, size_t patternLen)
+{
+	if(length < patternLen)
+	{
+		return length;
+	}
+	uint64_t lastStart = length - patternLen;
+	for(uint64_t i = 0; i <= lastStart; )
+	{
+		const unsigned char* candidate = (const unsigned char*)memchr(buffer + i, pattern[0], lastStart + 1 - i);
+		if(candidate == NULL)
+		{
+			return length;
+		}
+		i = (uint64_t)(candidate - buffer);
+		if(memcmp(candidate + 1, pattern + 1, patternLen - 1) == 0)
+		{
+			return i;
+		}
+		i++;
+	}
+
+	return length;
+}
+
+#ifdef CARVE_X86_SIMD
+// findPatternAVX2(): Pattern finder testing 32 start positions at a time. Positions whose first and last
+// bytes both match the pattern are candidates, and only those are compared in full. Scalar tail.
+__attribute__((target("avx2")))
+uint64_t findPatternAVX2(const unsigned char* buffer, uint64_t length, const unsigned char* pattern, size_t patternLen)
+{
+	if(length < patternLen)
+	{
+		return length;
+	}
+	uint64_t lastStart = length - patternLen;
+	const __m256i first = _mm256_set1_epi8((char)pattern[0]);
+	const __m256i last = _mm256_set1_epi8((char)pattern[patternLen - 1]);
+	uint64_t i = 0;
+	for(; i + 31 <= lastStart; i += 32)
+	{
+		__m256i firstBlock = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		__m256i lastBlock = _mm256_loadu_si256((const __m256i*)(buffer + i + patternLen - 1));
+		uint32_t candidates = (uint32_t)_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(firstBlock, first), _mm256_cmpeq_epi8(lastBlock, last)));
+		while(candidates != 0)
+		{
+			uint64_t position = i + (uint64_t)__builtin_ctz(candidates);
+			if(patternLen <= 2 || memcmp(buffer + position + 1, pattern + 1, patternLen - 2) == 0)
+			{
+				return position;
+			}
+			candidates &= candidates - 1;
+		}
+	}
+
+	uint64_t tail = findPatternScalar(buffer + i, length - i, pattern, patternLen);
+	return (tail == length - i) ? length : i + tail;
+}
+
+// findByteSetAVX2(): Position of the first byte equal to any of a few first bytes, and when second bytes
+// are given followed by any of those, 32 positions at a time. Returns the length if there is none. Scalar tail.
+__attribute__((target("avx2")))
+uint64_t findByteSetAVX2(const unsigned char* buffer, uint64_t length, const unsigned char* first, int numFirst, const unsigned char* second, int numSecond)
+{
+	__m256i firstSets[MAX_SIMD_BYTE_SET];
+	__m256i secondSets[MAX_SIMD_BYTE_SET];
+	for(int b = 0; b < numFirst; b++)
+	{
+		firstSets[b] = _mm256_set1_epi8((char)first[b]);
+	}
+	for(int b = 0; b < numSecond; b++)
+	{
+		secondSets[b] = _mm256_set1_epi8((char)second[b]);
+	}
+	uint64_t i = 0;
+	for(; i + 33 <= length; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		__m256i hits = _mm256_cmpeq_epi8(block, firstSets[0]);
+		for(int b = 1; b < numFirst; b++)
+		{
+			hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, firstSets[b]));
+		}
+		if(numSecond > 0)
+		{
+			__m256i nextBlock = _mm256_loadu_si256((const __m256i*)(buffer + i + 1));
+			__m256i nextHits = _mm256_cmpeq_epi8(nextBlock, secondSets[0]);
+			for(int b = 1; b < numSecond; b++)
+			{
+				nextHits = _mm256_or_si256(nextHits, _mm256_cmpeq_epi8(nextBlock, secondSets[b]));
+			}
+			hits = _mm256_and_si256(hits, nextHits);
+		}
+		uint32_t mask = (uint32_t)_mm256_movemask_epi8(hits);
+		if(mask != 0)
+		{
+			return i + (uint64_t)__builtin_ctz(mask);
+		}
+	}
+	for(; i < length; i++)
+	{
+		if(memchr(first, buffer[i], numFirst) != NULL
+			&& (numSecond == 0 || (i + 1 < length && memchr(second, buffer[i + 1], numSecond) != NULL)))
+		{
+			return i;
+		}
+	}
+
+	return length;
+}
+#endif
+
+// getPatternFinderName(): Name of the pattern finder chosen for this cpu.
+// Return: const char*; "avx2" or "scalar".
+const char* getPatternFinderName()
+{
+#ifdef CARVE_X86_SIMD
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return "avx2";
+	}
+#endif
+	return "scalar";
+}
+
+// getPatternFinder(): Pattern finder chosen by cpu feature detection, selected once on first use.
+// Return: PatternFinder; widest supported finder.
+PatternFinder getPatternFinder()
+{
+	static const PatternFinder finder = []() -> PatternFinder {
+		const char* name = getPatternFinderName();
+#ifdef CARVE_X86_SIMD
+		if(strcmp(name, "avx2") == 0)
+		{
+			return findPatternAVX2;
+		}
+#endif
+		(void)name;
+		return findPatternScalar;
+	}();
+
+	return finder;
+}
+
+// ScanEndFinder: Function returning the position of the first 0xFF within entropy coded data that begins a
+// marker, one followed by neither a stuffed zero nor a restart marker, or the buffer length if there is none.
+typedef uint64_t (*ScanEndFinder)(const unsigned char* buffer, uint64_t length);
+
+// findScanEndScalar(): Portable scan end finder, memchr for each 0xFF then a check of the byte after it.
+uint64_t findScanEndScalar(const unsigned char* buffer, uint64_t length)
+{
+	for(uint64_t i = 0; i + 1 < length; i++)
+	{
+		const unsigned char* candidate = (const unsigned char*)memchr(buffer + i, JPEG_MARKER, length - 1 - i);
+		if(candidate == NULL)
+		{
+			return length;
+		}
+		i = (uint64_t)(candidate - buffer);
+		unsigned char next = buffer[i + 1];
+		if(next != 0x00 && (next < JPEG_RST0 || next > JPEG_RST7))
+		{
+			return i;
+		}
+	}
+
+	return length;
+}
+
+#ifdef CARVE_X86_SIMD
+// findScanEndAVX2(): Scan end finder testing 32 positions at a time, the byte after each 0xFF checked in
+// the same pass, so stuffed bytes and restart markers cost no extra work. Scalar tail.
+__attribute__((target("avx2")))
+uint64_t findScanEndAVX2(const unsigned char* buffer, uint64_t length)
+{
+	const __m256i marker = _mm256_set1_epi8((char)JPEG_MARKER);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i restartMask = _mm256_set1_epi8((char)0xF8);
+	const __m256i restart = _mm256_set1_epi8((char)JPEG_RST0);
+	uint64_t i = 0;
+	for(; i + 33 <= length; i += 32)
+	{
+		__m256i block = _mm256_loadu_si256((const __m256i*)(buffer + i));
+		__m256i nextBlock = _mm256_loadu_si256((const __m256i*)(buffer + i + 1));
+		__m256i notMarker = _mm256_or_si256(_mm256_cmpeq_epi8(nextBlock, zero), _mm256_cmpeq_epi8(_mm256_and_si256(nextBlock, restartMask), restart));
+		uint32_t candidates = (uint32_t)_mm256_movemask_epi8(_mm256_andnot_si256(notMarker, _mm256_cmpeq_epi8(block, marker)));
+		if(candidates != 0)
+		{
+			return i + (uint64_t)__builtin_ctz(candidates);
+		}
+	}
+
+	uint64_t tail = findScanEndScalar(buffer + i, length - i);
+	return (tail == length - i) ? length : i + tail;
+}
+#endif
+
+// getScanEndFinder(): Scan end finder chosen by cpu feature detection, selected once on first use.
+// Return: ScanEndFinder; widest supported finder.
+ScanEndFinder getScanEndFinder()
+{
+	static const ScanEndFinder finder = []() -> ScanEndFinder {
+#ifdef CARVE_X86_SIMD
+		if(strcmp(getPatternFinderName(), "avx2") == 0)
+		{
+			return findScanEndAVX2;
+		}
+#endif
+		return findScanEndScalar;
+	}();
+
+	return finder;
+}
+
+// findPattern(): Finds the first occurrence of a pattern at or after a start position.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			uint64_t; first position to search from
+//			unsigned char*; pattern, at least one byte
+//			size_t; length of the pattern
+//			PatternFinder; finder to use
+// Return:	uint64_t; position of the pattern, length if not found
+uint64_t findPattern(const unsigned char* buffer, const uint64_t length, const uint64_t start, const unsigned char* pattern, const size_t patternLen, PatternFinder finder)
+{
+	if(start >= length)
+	{
+		return length;
+	}
+	uint64_t position = finder(buffer + start, length - start, pattern, patternLen);
+	return (position == length - start) ? length : start + position;
+}
+
+// scanJpegs(): Finds each jpeg within a buffer, a jpeg being the magic bytes through the first
+// JPEG_TERMINATOR after them. Searching resumes on the terminator's last byte. A header with no
+// terminator after it ends the scan.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			unsigned char*; magic bytes starting each jpeg, at least one
+//			size_t; number of magic bytes
+//			(OUT) vector<JpegSpan>; offset and size of each jpeg found, appended in offset order
+//			PatternFinder; finder to use (widest supported by default)
+void scanJpegs(const unsigned char* buffer, const uint64_t length, const unsigned char* magicBytes, const size_t numMagicBytes, vector<JpegSpan> &spans, PatternFinder finder = getPatternFinder())
+{
+	uint64_t i = 0;
+	while(i < length)
+	{
+		uint64_t header = findPattern(buffer, length, i, magicBytes, numMagicBytes, finder);
+		if(header == length)
+		{
+			return;
+		}
+		uint64_t terminator = findPattern(buffer, length, header + numMagicBytes, JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE, finder);
+		if(terminator == length)
+		{
+			return;
+		}
+
+		JpegSpan newSpan;
+		newSpan.offset = header;
+		newSpan.size = (terminator + JPEG_TERMINATOR_SIZE) - header; // accounts for length of terminator
+		newSpan.signature = 0;
+		spans.push_back(newSpan);
+		i = terminator + JPEG_TERMINATOR_SIZE - 1;
+	}
+}
+
+// scanJpegsBytewise(): Reference for scanJpegs(), checkMatch() at every byte offset.
+void scanJpegsBytewise(const unsigned char* buffer, const uint64_t length, const unsigned char* magicBytes, const size_t numMagicBytes, vector<JpegSpan> &spans)
+{
+	uint64_t i = 0;
+	while(i + numMagicBytes <= length)
+	{
+		// If jpeg found
+		if(checkMatch(&buffer[i], magicBytes, (int32_t)numMagicBytes) == true)
+		{
+			JpegSpan newSpan;
+			newSpan.offset = i;
+			newSpan.signature = 0;
+
+			// Find end of jpeg
+			i += numMagicBytes;
+			while(i + JPEG_TERMINATOR_SIZE <= length && checkMatch(&buffer[i], JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE) == false)
+			{
+				i++;
+			}
+			if(i + JPEG_TERMINATOR_SIZE > length)
+			{
+				return;
+			}
+			newSpan.size = (i + JPEG_TERMINATOR_SIZE) - newSpan.offset;
+			spans.push_back(newSpan);
+
+			// Move to end of terminator
+			i += JPEG_TERMINATOR_SIZE - 1;
+		}
+		else
+		{
+			i++;
+		}
+	}
+}
+
+/***********************/
+/******* Classes *******/
+// SignatureMatcher: Aho-Corasick automaton over many signatures, finding the first header of any of
+// them in one pass whatever the number of signatures. Transitions are resolved into a full table (256 per
+// state), so each byte costs one lookup. While in the start state, bytes that begin no signature are skipped
+// (memchr for one distinct first byte, simd compares of the first two bytes for a few, a lookup of the first
+// two bytes in a bitmap of signature prefixes otherwise).
+class SignatureMatcher {
+private:
+	vector<Signature> signatures;
+	vector<uint32_t> transitions;	// Next state for each state and byte
+	vector<int32_t> outputs;		// Signature ending at each state (first in list order for duplicates), -1 if none
+	vector<uint32_t> outputLinks;	// Nearest state along the failure links with an output, 0 if none
+	bool firstBytes[256];			// Flag for each byte that begins some signature
+	unsigned char firstByteList[256];	// Distinct first bytes
+	int numFirstBytes;				// Number of distinct first bytes
+	unsigned char secondByteList[256];	// Distinct second bytes, if every signature has one
+	int numSecondBytes;				// Number of distinct second bytes, 0 if some signature is one byte
+	vector<uint64_t> prefixBits;	// Bit for each first two bytes (first byte low) some signature starts with, empty if some signature is one byte
+	bool simdSkip;					// Flag for skipping to first bytes with findByteSetAVX2()
+	size_t maxLength;				// Longest signature
+
+	// skipToFirstByte(): Position of the next byte beginning some signature, limit if none.
+	uint64_t skipToFirstByte(const unsigned char* buffer, const uint64_t i, const uint64_t limit) const
+	{
+		if(numFirstBytes == 1)
+		{
+			const unsigned char* next = (const unsigned char*)memchr(buffer + i, firstByteList[0], limit - i);
+			return (next == NULL) ? limit : (uint64_t)(next - buffer);
+		}
+#ifdef CARVE_X86_SIMD
+		if(simdSkip == true)
+		{
+			return i + findByteSetAVX2(buffer + i, limit - i, firstByteList, numFirstBytes, secondByteList, numSecondBytes);
+		}
+#endif
+		uint64_t next = i;
+		if(prefixBits.empty() == false)
+		{
+			while(next + 1 < limit)
+			{
+				uint32_t prefix = (uint32_t)buffer[next] | ((uint32_t)buffer[next + 1] << 8);
+				if(((prefixBits[prefix >> 6] >> (prefix & 63)) & 1) != 0)
+				{
+					return next;
+				}
+				next++;
+			}
+			return limit;
+		}
+		while(next < limit && firstBytes[buffer[next]] == false)
+		{
+			next++;
+		}
+		return next;
+	}
+
+public:
+	// Construct
+	SignatureMatcher()
+	{
+		memset(firstBytes, 0, sizeof(firstBytes));
+		numFirstBytes = 0;
+		numSecondBytes = 0;
+		simdSkip = false;
+		maxLength = 0;
+	}
+	SignatureMatcher(const vector<Signature> &newSignatures)
+	{
+		build(newSignatures);
+	}
+
+	// build(): Compiles signatures into the automaton, replacing any previous ones.
+	// Params:	vector<Signature>; signatures, in priority order (earlier wins for headers starting together)
+	// Return:	bool; flag for if built. False if a signature has no pattern bytes.
+	bool build(const vector<Signature> &newSignatures)
+	{
+		signatures = newSignatures;
+		transitions.assign(256, 0);
+		outputs.assign(1, -1);
+		memset(firstBytes, 0, sizeof(firstBytes));
+		numFirstBytes = 0;
+		numSecondBytes = 0;
+		simdSkip = false;
+		maxLength = 0;
+		size_t minLength = SIZE_MAX;
+		bool secondBytes[256] = {false};
+
+		// Trie of every pattern, 0 marks a missing child (the start state is never a child)
+		for(size_t sig = 0; sig < signatures.size(); sig++)
+		{
+			const vector<unsigned char> &pattern = signatures[sig].pattern;
+			if(pattern.empty() == true)
+			{
+				signatures.clear();
+				transitions.assign(256, 0);
+				return false;
+			}
+			uint32_t state = 0;
+			for(size_t k = 0; k < pattern.size(); k++)
+			{
+				if(transitions[state * 256 + pattern[k]] == 0)
+				{
+					transitions[state * 256 + pattern[k]] = (uint32_t)outputs.size();
+					transitions.resize(transitions.size() + 256, 0);
+					outputs.push_back(-1);
+				}
+				state = transitions[state * 256 + pattern[k]];
+			}
+			if(outputs[state] < 0)
+			{
+				outputs[state] = (int32_t)sig;
+			}
+			if(firstBytes[pattern[0]] == false)
+			{
+				firstBytes[pattern[0]] = true;
+				firstByteList[numFirstBytes] = pattern[0];
+				numFirstBytes++;
+			}
+			if(pattern.size() > 1 && secondBytes[pattern[1]] == false)
+			{
+				secondBytes[pattern[1]] = true;
+				secondByteList[numSecondBytes] = pattern[1];
+				numSecondBytes++;
+			}
+			maxLength = (pattern.size() > maxLength) ? pattern.size() : maxLength;
+			minLength = (pattern.size() < minLength) ? pattern.size() : minLength;
+		}
+		prefixBits.clear();
+		if(minLength >= 2)
+		{
+			prefixBits.assign(65536 / 64, 0);
+			for(size_t sig = 0; sig < signatures.size(); sig++)
+			{
+				uint32_t prefix = (uint32_t)signatures[sig].pattern[0] | ((uint32_t)signatures[sig].pattern[1] << 8);
+				prefixBits[prefix >> 6] |= (uint64_t)1 << (prefix & 63);
+			}
+		}
+		if(minLength < 2 || numSecondBytes > MAX_SIMD_BYTE_SET)
+		{
+			numSecondBytes = 0;
+		}
+		simdSkip = (numFirstBytes <= MAX_SIMD_BYTE_SET && strcmp(getPatternFinderName(), "avx2") == 0);
+
+		// Failure links breadth first, filling missing transitions from the failure state
+		vector<uint32_t> failure(outputs.size(), 0);
+		outputLinks.assign(outputs.size(), 0);
+		vector<uint32_t> queue(1, 0);
+		for(size_t q = 0; q < queue.size(); q++)
+		{
+			uint32_t state = queue[q];
+			for(int c = 0; c < 256; c++)
+			{
+				uint32_t child = transitions[state * 256 + c];
+				if(child != 0)
+				{
+					failure[child] = (state == 0) ? 0 : transitions[failure[state] * 256 + c];
+					outputLinks[child] = (outputs[failure[child]] >= 0) ? failure[child] : outputLinks[failure[child]];
+					queue.push_back(child);
+				}
+				else if(state != 0)
+				{
+					transitions[state * 256 + c] = transitions[failure[state] * 256 + c];
+				}
+			}
+		}
+
+		return true;
+	}
+
+	// findHeader(): Finds the first signature header at or after a start position. Headers are ordered by
+	// start position then signature index, so after a match the scan continues until no longer signature
+	// could start as early.
+	// Params:	unsigned char*; buffer searched
+	//			uint64_t; length of the buffer
+	//			uint64_t; first position a header may start at
+	//			(OUT) uint32_t; index of the signature found
+	// Return:	uint64_t; position of the header, length if none
+	uint64_t findHeader(const unsigned char* buffer, const uint64_t length, const uint64_t start, uint32_t &signature) const
+	{
+		uint64_t bestStart = length;
+		uint32_t bestSignature = 0;
+		uint64_t limit = length;
+		uint32_t state = 0;
+		for(uint64_t i = start; i < limit; i++)
+		{
+			// Skip bytes that can not begin a header
+			if(state == 0)
+			{
+				i = skipToFirstByte(buffer, i, limit);
+				if(i >= limit)
+				{
+					break;
+				}
+			}
+
+			state = transitions[state * 256 + buffer[i]];
+			for(uint32_t match = (outputs[state] >= 0) ? state : outputLinks[state]; match != 0; match = outputLinks[match])
+			{
+				uint32_t sig = (uint32_t)outputs[match];
+				uint64_t matchStart = i + 1 - signatures[sig].pattern.size();
+				if(matchStart < bestStart || (matchStart == bestStart && sig < bestSignature))
+				{
+					bestStart = matchStart;
+					bestSignature = sig;
+				}
+			}
+			if(bestStart != length && bestStart + maxLength < limit)
+			{
+				limit = bestStart + maxLength; // a header starting as early would have ended by here
+			}
+		}
+
+		signature = bestSignature;
+		return bestStart;
+	}
+
+	// Getters
+	size_t getNumSignatures() const { return signatures.size(); }
+	const Signature& getSignature(const size_t index) const { return signatures[index]; }
+	size_t getNumStates() const { return outputs.size(); }
+	size_t getMaxLength() const { return maxLength; }
+};
+
+/***********************/
+/****** Carving ********/
+// findSignatureHeader(): Finds the first header at or after a start position that begins before a header
+// limit. Headers may run up to the longest signature past the limit, so no header starting before it is missed.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			uint64_t; first position a header may start at
+//			uint64_t; position headers must start before
+//			SignatureMatcher; compiled signatures
+//			PatternFinder; finder for headers of a single signature
+//			(OUT) uint32_t; index of the signature found
+// Return:	uint64_t; position of the header, the header limit if none
+uint64_t findSignatureHeader(const unsigned char* buffer, const uint64_t length, const uint64_t start, const uint64_t headerLimit,
+	const SignatureMatcher &matcher, PatternFinder finder, uint32_t &signature)
+{
+	uint64_t searchEnd = (length - headerLimit < matcher.getMaxLength()) ? length : (headerLimit + matcher.getMaxLength() - 1);
+	uint64_t header = 0;
+	signature = 0;
+	if(matcher.getNumSignatures() == 1)
+	{
+		header = findPattern(buffer, searchEnd, start, matcher.getSignature(0).pattern.data(), matcher.getSignature(0).pattern.size(), finder);
+	}
+	else
+	{
+		header = matcher.findHeader(buffer, searchEnd, start, signature);
+	}
+
+	return (header >= headerLimit) ? headerLimit : header;
+}
+
+// walkJpegMarkers(): Finds the end of a jpeg by walking its marker segments, as repaired. Length prefixed
+// segments are jumped over without reading their contents (so a thumbnail's terminator inside one is not
+// taken for the image's), and only entropy coded data after each SOS segment is searched, for the next 0xFF
+// that is not a stuffed zero or a restart marker. Reserved markers, scans without a frame header or with a
+// malformed scan header, and EOI before any scan mark a false header.
+// Params:	unsigned char*; buffer holding the jpeg
+//			uint64_t; position the walk must end before (end of buffer or size cutoff)
+//			uint64_t; position of the jpeg's header
+//			vector<unsigned char>; repair bytes written over the start of the jpeg, beginning with SOI
+//			(OUT) bool; flag for if the walk stopped at the limit rather than at a false header
+//			ScanEndFinder; finder for the marker ending entropy coded data (widest supported by default)
+// Return:	uint64_t; position after the EOI marker, 0 if the jpeg is malformed or runs past the limit
+uint64_t walkJpegMarkers(const unsigned char* buffer, const uint64_t limit, const uint64_t header, const vector<unsigned char> &repair,
+	bool &reachedLimit, ScanEndFinder finder = getScanEndFinder())
+{
+	const uint64_t repairEnd = header + repair.size();
+	reachedLimit = true; // cleared below where the walk stops on a false header
+	auto byteAt = [&](const uint64_t pos) { return (pos < repairEnd) ? repair[pos - header] : buffer[pos]; };
+
+	uint64_t p = header + 2; // after SOI
+	bool frameFound = false; // a scan must follow a frame header
+	bool scanFound = false;	 // EOI must follow a scan
+	while(true)
+	{
+		// Marker, after any fill bytes
+		if(p >= limit)
+		{
+			return 0;
+		}
+		if(byteAt(p) != JPEG_MARKER)
+		{
+			reachedLimit = false;
+			return 0;
+		}
+		while(p < limit && byteAt(p) == JPEG_MARKER)
+		{
+			p++;
+		}
+		if(p >= limit)
+		{
+			return 0;
+		}
+		unsigned char marker = byteAt(p);
+		p++;
+		if(marker == JPEG_EOI)
+		{
+			reachedLimit = false;
+			return (scanFound == true) ? p : 0;
+		}
+		if(marker == JPEG_TEM || (marker >= JPEG_RST0 && marker <= JPEG_RST7))
+		{
+			continue;
+		}
+		if(marker < JPEG_FIRST_SEGMENT || marker == JPEG_SOI)
+		{
+			reachedLimit = false;
+			return 0; // not a marker a jpeg holds here, a false header
+		}
+
+		// Jump over the segment, its big endian length counts itself
+		if(limit - p < 2)
+		{
+			return 0;
+		}
+		uint64_t segmentLen = ((uint64_t)byteAt(p) << 8) | byteAt(p + 1);
+		if(segmentLen < 2)
+		{
+			reachedLimit = false;
+			return 0;
+		}
+		if(limit - p < segmentLen)
+		{
+			return 0;
+		}
+		if(marker >= JPEG_SOF0 && marker <= JPEG_SOF15 && marker != JPEG_DHT && marker != JPEG_JPG && marker != JPEG_DAC)
+		{
+			frameFound = true;
+		}
+		if(marker == JPEG_SOS)
+		{
+			// Scan header holds 1 to 4 components of 2 bytes each, a wrong length would jump into other data
+			uint64_t numComponents = (segmentLen > 2) ? byteAt(p + 2) : 0;
+			if(frameFound == false || numComponents < 1 || numComponents > 4 || segmentLen != 6 + 2 * numComponents)
+			{
+				reachedLimit = false;
+				return 0;
+			}
+			scanFound = true;
+		}
+		p += segmentLen;
+
+		// Entropy coded data runs to the next marker, fill bytes before it are skipped above
+		if(marker == JPEG_SOS)
+		{
+			if(p < repairEnd)
+			{
+				reachedLimit = false;
+				return 0; // repair bytes only cover the start of a jpeg
+			}
+			uint64_t scanEnd = finder(buffer + p, limit - p);
+			if(scanEnd == limit - p)
+			{
+				return 0;
+			}
+			p += scanEnd;
+		}
+	}
+}
+
+// findJpegEnd(): Finds where a jpeg starting at a header ends, as the carve options ask. Marker walks need
+// repair bytes beginning with SOI, other signatures end at their terminator. The search reads no further
+// than a reach, so an end it does not find may still lie past the reach.
+// Params:	unsigned char*; buffer holding the jpeg
+//			uint64_t; length of the buffer
+//			uint64_t; position of the jpeg's header
+//			uint64_t; position the search stops at, after the header (length to search the whole buffer)
+//			Signature; signature matched at the header
+//			CarveOptions; how the end is found, and the size cutoff
+//			PatternFinder; finder for terminators
+//			(OUT) bool; flag for if the end was not found but may lie past the reach
+// Return:	uint64_t; position after the jpeg, 0 if there is none within the reach and cutoff
+uint64_t findJpegEnd(const unsigned char* buffer, const uint64_t length, const uint64_t header, const uint64_t reach, const Signature &signature,
+	const CarveOptions &options, PatternFinder finder, bool &pastReach)
+{
+	uint64_t limit = (options.maxSize != 0 && length - header > options.maxSize) ? (header + options.maxSize) : length;
+	uint64_t searchLimit = (reach < limit) ? reach : limit;
+	if(options.end == END_BY_MARKERS && signature.repair.size() >= 2 && signature.repair[0] == JPEG_MARKER && signature.repair[1] == JPEG_SOI)
+	{
+		bool reachedLimit = false;
+		uint64_t end = walkJpegMarkers(buffer, searchLimit, header, signature.repair, reachedLimit);
+		pastReach = (end == 0 && reachedLimit == true && searchLimit < limit);
+		return end;
+	}
+
+	uint64_t terminator = findPattern(buffer, searchLimit, header + signature.pattern.size(), JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE, finder);
+	pastReach = (terminator == searchLimit && searchLimit < limit);
+	return (terminator == searchLimit) ? 0 : (terminator + JPEG_TERMINATOR_SIZE);
+}
+
+// findNextJpeg(): One step of carveSignatures(). Finds the first header at or after a start position that
+// begins before a header limit (see findSignatureHeader()), then its end (see findJpegEnd()). The end may
+// lie anywhere before the reach. With the default options a header without a terminator ends the carve;
+// otherwise a header whose end is not found is skipped as a false match and the search carries on. A header
+// whose end may lie past the reach stops the search, as the outcome depends on bytes it did not read.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			uint64_t; first position a header may start at
+//			uint64_t; position headers must start before
+//			uint64_t; position end searches stop at, at or after the header limit (length to search the whole buffer)
+//			SignatureMatcher; compiled signatures
+//			CarveOptions; how jpeg ends are found, and the size cutoff
+//			PatternFinder; finder for terminators, and headers of a single signature
+//			(OUT) JpegSpan; jpeg found, only the offset and signature set if there is no terminator
+// Return:	CarveStep; outcome of the search
+CarveStep findNextJpeg(const unsigned char* buffer, const uint64_t length, const uint64_t start, const uint64_t headerLimit, const uint64_t reach,
+	const SignatureMatcher &matcher, const CarveOptions &options, PatternFinder finder, JpegSpan &span)
+{
+	const bool skipFalseHeaders = (options.end != END_AT_TERMINATOR || options.maxSize != 0);
+	uint64_t i = start;
+	while(true)
+	{
+		uint32_t signature = 0;
+		uint64_t header = findSignatureHeader(buffer, length, i, headerLimit, matcher, finder, signature);
+		if(header == headerLimit)
+		{
+			return CARVE_NO_HEADER;
+		}
+
+		span.offset = header;
+		span.signature = signature;
+		bool pastReach = false;
+		uint64_t end = findJpegEnd(buffer, length, header, reach, matcher.getSignature(signature), options, finder, pastReach);
+		if(end != 0)
+		{
+			span.size = end - header;
+			return CARVE_FOUND;
+		}
+		if(pastReach == true)
+		{
+			return CARVE_UNRESOLVED;
+		}
+		if(skipFalseHeaders == false)
+		{
+			return CARVE_NO_TERMINATOR;
+		}
+		i = header + 1;
+	}
+}
+
+// carveSignatures(): scanJpegs() for many signatures at once. Each header is the earliest starting
+// header of any signature, and by default runs through the first JPEG_TERMINATOR after it. A single
+// signature is searched for with the pattern finder instead of the automaton.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			SignatureMatcher; compiled signatures
+//			(OUT) vector<JpegSpan>; offset, size and signature of each jpeg found, appended in offset order
+//			CarveOptions; how jpeg ends are found, and the size cutoff
+//			PatternFinder; finder for terminators (widest supported by default)
+void carveSignatures(const unsigned char* buffer, const uint64_t length, const SignatureMatcher &matcher, vector<JpegSpan> &spans,
+	const CarveOptions &options = CarveOptions(), PatternFinder finder = getPatternFinder())
+{
+	uint64_t i = 0;
+	JpegSpan newSpan;
+	while(i < length && findNextJpeg(buffer, length, i, length, length, matcher, options, finder, newSpan) == CARVE_FOUND)
+	{
+		spans.push_back(newSpan);
+		i = newSpan.offset + newSpan.size - 1; // the terminator's last byte may begin the next header
+	}
+}
+
+// carveChunk(): Carves the headers starting within one chunk, as carveSignatures() would if it began its
+// search at the chunk start. Ends are searched for up to a reach past the chunk end, and the carve stops at
+// a header whose end may lie further on. Records where each search began, so the chain can be joined to
+// the one before it.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			uint64_t; position end searches stop at
+//			SignatureMatcher; compiled signatures
+//			CarveOptions; how jpeg ends are found, and the size cutoff
+//			PatternFinder; finder for terminators, and headers of a single signature
+//			(IN/OUT) CarveChunk; chunk bounds in, carve out
+void carveChunk(const unsigned char* buffer, const uint64_t length, const uint64_t reach, const SignatureMatcher &matcher, const CarveOptions &options, PatternFinder finder, CarveChunk &chunk)
+{
+	uint64_t i = chunk.start;
+	JpegSpan newSpan;
+	while(true)
+	{
+		chunk.lastSearch = i;
+		chunk.lastStep = (i < chunk.end) ? findNextJpeg(buffer, length, i, chunk.end, reach, matcher, options, finder, newSpan) : CARVE_NO_HEADER;
+		if(chunk.lastStep != CARVE_FOUND)
+		{
+			chunk.openHeader = (chunk.lastStep == CARVE_NO_TERMINATOR) ? newSpan.offset : length;
+			return;
+		}
+		chunk.spans.push_back(newSpan);
+		chunk.searchStarts.push_back(i);
+		i = newSpan.offset + newSpan.size - 1;
+	}
+}
+
+// carveSignaturesParallel(): carveSignatures() across a thread pool, output identical to it. The input is cut
+// into chunks, and each chunk is carved as if a search began at its start. A chunk searches for ends no
+// further than the end of the chunk after it, so headers without a terminator cost each chunk at most two
+// chunks of reading rather than the rest of the input. Chunks are then joined in order: once the serial
+// search position falls between where a chunk's search for a jpeg began and that jpeg's header, the serial
+// carve would find the same jpeg and every one after it in the chunk. Searches the chunk does not cover (a
+// jpeg from an earlier chunk ending inside one of its jpegs, or a header whose end lies past the chunk's
+// reach) are redone serially over the whole buffer.
+// Params:	unsigned char*; buffer searched
+//			uint64_t; length of the buffer
+//			SignatureMatcher; compiled signatures
+//			(OUT) vector<JpegSpan>; offset, size and signature of each jpeg found, appended in offset order
+//			unsigned int; number of threads
+//			uint64_t; chunk size
+//			CarveOptions; how jpeg ends are found, and the size cutoff
+//			PatternFinder; finder for terminators (widest supported by default)
+void carveSignaturesParallel(const unsigned char* buffer, const uint64_t length, const SignatureMatcher &matcher, vector<JpegSpan> &spans,
+	const unsigned int numThreads, const uint64_t chunkSize = CARVE_CHUNK_SIZE, const CarveOptions &options = CarveOptions(), PatternFinder finder = getPatternFinder())
+{
+	if(numThreads <= 1 || length <= chunkSize || chunkSize == 0)
+	{
+		carveSignatures(buffer, length, matcher, spans, options, finder);
+		return;
+	}
+
+	// Carve chunks
+	vector<CarveChunk> chunks((length + chunkSize - 1) / chunkSize);
+	WorkStealingPool pool(numThreads);
+	for(size_t c = 0; c < chunks.size(); c++)
+	{
+		chunks[c].start = c * chunkSize;
+		chunks[c].end = (length - chunks[c].start < chunkSize) ? length : (chunks[c].start + chunkSize);
+		uint64_t reach = (length - chunks[c].end < chunkSize) ? length : (chunks[c].end + chunkSize);
+		pool.add([buffer, length, reach, &matcher, &options, finder, &chunks, c]() {
+			carveChunk(buffer, length, reach, matcher, options, finder, chunks[c]);
+		});
+	}
+	pool.run();
+
+	// Join chunks in order, following the serial search position
+	uint64_t i = 0;
+	for(size_t c = 0; c < chunks.size(); c++)
+	{
+		const CarveChunk &chunk = chunks[c];
+		size_t next = 0;
+		while(i < chunk.end)
+		{
+			while(next < chunk.spans.size() && chunk.spans[next].offset < i)
+			{
+				next++;
+			}
+			uint64_t chunkSearch = (next < chunk.spans.size()) ? chunk.searchStarts[next] : chunk.lastSearch;
+			if(chunkSearch <= i)
+			{
+				// Same search as the chunk's
+				if(next < chunk.spans.size())
+				{
+					spans.push_back(chunk.spans[next]);
+					i = chunk.spans[next].offset + chunk.spans[next].size - 1;
+					next++;
+					continue;
+				}
+				if(chunk.lastStep == CARVE_NO_HEADER)
+				{
+					break;
+				}
+				if(chunk.lastStep == CARVE_NO_TERMINATOR && chunk.openHeader >= i)
+				{
+					return; // header without a terminator ends the carve
+				}
+			}
+
+			// Search the chunk did not make
+			JpegSpan newSpan;
+			CarveStep step = findNextJpeg(buffer, length, i, chunk.end, length, matcher, options, finder, newSpan);
+			if(step == CARVE_NO_HEADER)
+			{
+				break;
+			}
+			if(step == CARVE_NO_TERMINATOR)
+			{
+				return;
+			}
+			spans.push_back(newSpan);
+			i = newSpan.offset + newSpan.size - 1;
+		}
+	}
+}
+
+// streamCarve(): carveSignatures() over an input stream, read through a fixed window so memory stays bounded
+// by the window size whatever the input size. Between refills the window keeps only bytes still needed: the
+// last longest-signature bytes while searching for a header, and the last byte while searching for a
+// terminator (it may begin one). Jpeg bytes are passed on as soon as they are read, so jpegs larger than the
+// window are carved too, and each jpeg is ended as soon as its terminator is read.
+// Params:	istream; input, read to its end
+//			SignatureMatcher; compiled signatures
+//			JpegHandlers; receivers for each jpeg's start, bytes and end
+//			size_t; window size, raised to hold at least two of the longest signature
+//			PatternFinder; finder for terminators, and headers of a single signature
+// Return:	uint64_t; bytes of input read
+uint64_t streamCarve(istream &input, const SignatureMatcher &matcher, const JpegHandlers &handlers, size_t windowSize = CARVE_WINDOW_SIZE,
+	PatternFinder finder = getPatternFinder())
+{
+	const uint64_t maxLength = matcher.getMaxLength();
+	if(windowSize < 2 * maxLength + JPEG_TERMINATOR_SIZE)
+	{
+		windowSize = 2 * maxLength + JPEG_TERMINATOR_SIZE;
+	}
+	vector<unsigned char> window(windowSize);
+	uint64_t base = 0;		// Input offset of the window's first byte
+	uint64_t filled = 0;	// Bytes of the window holding input
+	bool atEnd = false;		// Flag for the whole input having been read
+	bool inJpeg = false;	// Flag for a header found whose terminator is not yet read
+	uint64_t search = 0;	// Input offset the next header (or terminator, in a jpeg) search begins at
+	uint64_t header = 0;	// In a jpeg, input offset of its header
+	uint64_t passed = 0;	// In a jpeg, input offset of the first byte not yet passed on
+
+	while(true)
+	{
+		// Slide the bytes still needed to the front, and refill
+		uint64_t keep = (inJpeg == true) ? passed : search;
+		uint64_t kept = base + filled - keep;
+		memmove(window.data(), window.data() + (keep - base), (size_t)kept);
+		base = keep;
+		filled = kept;
+		while(filled < windowSize && atEnd == false)
+		{
+			input.read((char*)window.data() + filled, (streamsize)(windowSize - filled));
+			filled += (uint64_t)input.gcount();
+			atEnd = !input;
+		}
+		uint64_t windowEnd = base + filled;
+
+		// Carve the window, stopping where more input is needed
+		while(true)
+		{
+			if(inJpeg == false)
+			{
+				uint64_t headerLimit = windowEnd;
+				if(atEnd == false)
+				{
+					headerLimit = windowEnd - maxLength + 1; // a header starting later may run past the window
+				}
+				uint32_t signature = 0;
+				uint64_t found = (search < headerLimit) ? (base + findSignatureHeader(window.data(), filled, search - base, headerLimit - base, matcher, finder, signature)) : headerLimit;
+				if(found == headerLimit)
+				{
+					if(atEnd == true)
+					{
+						return windowEnd;
+					}
+					search = (search > headerLimit) ? search : headerLimit;
+					break;
+				}
+				inJpeg = true;
+				header = found;
+				passed = found;
+				search = found + matcher.getSignature(signature).pattern.size();
+				handlers.begin(found, signature);
+			}
+
+			uint64_t terminator = base + findPattern(window.data(), filled, search - base, JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE, finder);
+			if(terminator == windowEnd)
+			{
+				if(atEnd == true)
+				{
+					handlers.discard(); // no terminator, the carve ends as carveSignatures() would
+					return windowEnd;
+				}
+				uint64_t hold = windowEnd - (JPEG_TERMINATOR_SIZE - 1);
+				if(hold > passed)
+				{
+					handlers.data(window.data() + (passed - base), (size_t)(hold - passed));
+					passed = hold;
+				}
+				search = (search > hold) ? search : hold;
+				break;
+			}
+			uint64_t jpegEnd = terminator + JPEG_TERMINATOR_SIZE;
+			handlers.data(window.data() + (passed - base), (size_t)(jpegEnd - passed));
+			handlers.end(jpegEnd - header);
+			inJpeg = false;
+			search = jpegEnd - 1; // the terminator's last byte may begin the next header
+		}
+	}
+}
+
+// carveSignaturesBytewise(): Reference for carveSignatures(), every signature checked at every byte offset.
+void carveSignaturesBytewise(const unsigned char* buffer, const uint64_t length, const vector<Signature> &signatures, vector<JpegSpan> &spans)
+{
+	uint64_t i = 0;
+	while(i < length)
+	{
+		// First signature matching here, in list order
+		size_t sig = 0;
+		while(sig < signatures.size() && (i + signatures[sig].pattern.size() > length
+			|| checkMatch(&buffer[i], signatures[sig].pattern.data(), (int32_t)signatures[sig].pattern.size()) == false))
+		{
+			sig++;
+		}
+		if(sig == signatures.size())
+		{
+			i++;
+			continue;
+		}
+
+		// Find end of jpeg
+		JpegSpan newSpan;
+		newSpan.offset = i;
+		newSpan.signature = (uint32_t)sig;
+		i += signatures[sig].pattern.size();
+		while(i + JPEG_TERMINATOR_SIZE <= length && checkMatch(&buffer[i], JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE) == false)
+		{
+			i++;
+		}
+		if(i + JPEG_TERMINATOR_SIZE > length)
+		{
+			return;
+		}
+		newSpan.size = (i + JPEG_TERMINATOR_SIZE) - newSpan.offset;
+		spans.push_back(newSpan);
+		i += JPEG_TERMINATOR_SIZE - 1;
+	}
+}
+
+#endif
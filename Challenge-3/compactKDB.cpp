@@ -0,0 +1,63 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: writeKDB.h parseKDB.h lsfr.h keystreamCache.h mappedFile.h workStealingPool.h
+// Rewrites a kdb file with each entry's blocks contiguous, run as: compact.exe <input kdb> <output kdb>
+// REFERENCES: None
+
+#include <iostream>
+#include <string>
+#include <sys/stat.h>
+
+#include "parseKDB.h"
+#include "writeKDB.h"
+
+using namespace std;
+
+/***********************/
+/********* Main ********/
+int main(int argc, char* argv[])
+{
+	if(argc != 3)
+	{
+		cout << "Usage: compact.exe <input kdb> <output kdb>" << endl;
+		return 1;
+	}
+	string inFileName = argv[1];
+	string outFileName = argv[2];
+
+	// Output is truncated while input is still mapped, so refuse any path naming the same file (links included)
+	struct stat inStat;
+	struct stat outStat;
+	if(stat(inFileName.c_str(), &inStat) == 0 && stat(outFileName.c_str(), &outStat) == 0
+		&& inStat.st_dev == outStat.st_dev && inStat.st_ino == outStat.st_ino)
+	{
+		cout << "Error: output must be a different file than input" << endl;
+		return 1;
+	}
+
+	// Map input kdb file
+	MappedFile kdbFile(inFileName, ACCESS_SEQUENTIAL);
+	if(kdbFile.isOpen() == false)
+	{
+		cout << "Error: file " << inFileName << " not found" << endl;
+		return 1;
+	}
+
+	// Write compacted copy
+	KdbError error;
+	if(compactKDB(kdbFile.getData(), kdbFile.getSize(), outFileName, error) == false)
+	{
+		if(error.code != KDB_OK)
+		{
+			cout << "Error: malformed kdb file (" << getKdbErrorName(error.code) << " at offset " << error.position << ")" << endl;
+		}
+		else
+		{
+			cout << "Error: could not write " << outFileName << endl;
+		}
+		return 1;
+	}
+	kdbFile.close();
+
+	return 0;
+}
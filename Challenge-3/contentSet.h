@@ -0,0 +1,137 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: multiMD5.h workStealingPool.h
+// Grouping carved jpegs by content, for writing each distinct jpeg once.
+// REFERENCES:
+// - Mutual exclusion, Reference: https://www.cplusplus.com/reference/mutex/lock_guard/
+
+#ifndef CONTENTSET_H
+#define CONTENTSET_H
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+#include "multiMD5.h"
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+const size_t CONTENT_SET_SHARDS = 64;	// Independently locked parts of a ContentSet
+
+/***********************/
+/******* Classes *******/
+// ContentGroup: Jpegs sharing content, by size and md5 digest.
+struct ContentGroup {
+	uint64_t size;							// Length of the content
+	unsigned char digest[MD5_DIGEST_SIZE];	// md5 digest of the content
+	vector<size_t> members;					// Indices of the jpegs holding the content
+
+	ContentGroup(const uint64_t newSize, const unsigned char* newDigest, const size_t member)
+	{
+		size = newSize;
+		memcpy(digest, newDigest, MD5_DIGEST_SIZE);
+		members.push_back(member);
+	}
+};
+
+// ContentSet: Set of distinct jpeg contents, safe to insert into from many threads at once. The first 8
+// bytes of the md5 digest pick a shard and bucket, as digest bits are already uniform, so no second hash
+// of the content is needed and threads only contend on equal or colliding keys. The whole digest and
+// size confirm a match within the bucket.
+class ContentSet {
+private:
+	struct Shard {
+		mutex lock;
+		unordered_map< uint64_t, vector<ContentGroup> > buckets;	// Groups by digest key
+	};
+
+	vector< unique_ptr<Shard> > shards;	// Parts of the set, each with its own lock
+
+public:
+	// Construct
+	ContentSet(size_t numShards = CONTENT_SET_SHARDS)
+	{
+		if(numShards == 0)
+		{
+			numShards = 1;
+		}
+		for(size_t s = 0; s < numShards; s++)
+		{
+			shards.push_back(unique_ptr<Shard>(new Shard()));
+		}
+	}
+
+	// insert(): Adds a jpeg to the group holding its content, or to a new group.
+	// Params:	uint64_t; length of the jpeg
+	//			unsigned char*; md5 digest of the jpeg
+	//			size_t; index of the jpeg
+	// Return:	bool; flag for if the content was new to the set.
+	bool insert(const uint64_t size, const unsigned char* digest, const size_t member)
+	{
+		uint64_t key;
+		memcpy(&key, digest, sizeof(key));
+		Shard &shard = *shards[(key >> 32) % shards.size()];
+		lock_guard<mutex> guard(shard.lock);
+		vector<ContentGroup> &bucket = shard.buckets[key];
+		for(size_t g = 0; g < bucket.size(); g++)
+		{
+			if(bucket[g].size == size && memcmp(bucket[g].digest, digest, MD5_DIGEST_SIZE) == 0)
+			{
+				bucket[g].members.push_back(member);
+				return false;
+			}
+		}
+		bucket.push_back(ContentGroup(size, digest, member));
+
+		return true;
+	}
+
+	// getGroups(): Every group, members in ascending order and groups ordered by their first member, so the
+	// result does not depend on the order of inserts. Not to be called while other threads insert.
+	// Return:	vector<ContentGroup>; distinct contents of the set
+	vector<ContentGroup> getGroups() const
+	{
+		vector<ContentGroup> groups;
+		for(size_t s = 0; s < shards.size(); s++)
+		{
+			for(unordered_map< uint64_t, vector<ContentGroup> >::const_iterator bucketIt = shards[s]->buckets.begin(); bucketIt != shards[s]->buckets.end(); bucketIt++)
+			{
+				groups.insert(groups.end(), bucketIt->second.begin(), bucketIt->second.end());
+			}
+		}
+		for(size_t g = 0; g < groups.size(); g++)
+		{
+			sort(groups[g].members.begin(), groups[g].members.end());
+		}
+		sort(groups.begin(), groups.end(), [](const ContentGroup &a, const ContentGroup &b) {
+			return a.members[0] < b.members[0];
+		});
+
+		return groups;
+	}
+};
+
+/***********************/
+/***** Procedures ******/
+// groupMd5Jobs(): Hashes every job as hashMd5Jobs() does, and groups them by content into a set. Each thread
+// inserts its run of jobs by digest as soon as the run is hashed, so grouping adds no pass over the content.
+// Params:	vector<Md5Job>; jobs hashed, digests set
+//			unsigned int; number of threads
+//			ContentSet; set the jobs are inserted into, by index
+void groupMd5Jobs(vector<Md5Job> &jobs, const unsigned int numThreads, ContentSet &contentSet)
+{
+	hashMd5Jobs(jobs, numThreads, [&jobs, &contentSet](size_t first, size_t count) {
+		for(size_t j = first; j < first + count; j++)
+		{
+			contentSet.insert(jobs[j].headSize + jobs[j].bodySize, jobs[j].digest, j);
+		}
+	});
+}
+
+#endif
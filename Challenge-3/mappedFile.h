@@ -0,0 +1,205 @@
+// David Ramsey
+// Last updated 01/31/2021
+// REFERENCES:
+// - Memory mapping a file (Linux/Unix), References: https://man7.org/linux/man-pages/man2/mmap.2.html, https://man7.org/linux/man-pages/man2/madvise.2.html
+// - For opending a binary file properly, and getting file length, Reference: http://www.cplusplus.com/reference/istream/istream/read/
+
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <fstream>
+#include <string>
+#include <stdint.h>
+
+#if defined(__linux__) || defined(__unix__) || defined(__APPLE__)
+#define MAPPEDFILE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+enum MappedFileAccess {
+	ACCESS_SEQUENTIAL,	// Data read front to back (e.g. scanning), read ahead aggressively
+	ACCESS_RANDOM		// Data read by offset (e.g. following kdb lists), no read ahead
+};
+
+/***********************/
+/******* Classes *******/
+// MappedFile: Read-only view of a whole file. Memory mapped where supported, so pages are only
+// read in when touched and no copy of the file is made. Falls back to reading the file into a buffer.
+// Move-only, the mapping is released on destruction.
+class MappedFile {
+private:
+	const unsigned char* data;	// Start of file data
+	uint64_t size;				// Length of file data
+	bool mapped;				// Flag for if data is a mapping (true) or a heap buffer (false)
+	bool opened;				// Flag for if a file is held (an empty file has no data)
+
+	void release()
+	{
+		if(data != NULL)
+		{
+			#ifdef MAPPEDFILE_MMAP
+			if(mapped == true)
+			{
+				munmap((void*)data, size);
+			}
+			else
+			#endif
+			{
+				delete [] data;
+			}
+		}
+		data = NULL;
+		size = 0;
+		mapped = false;
+		opened = false;
+	}
+
+public:
+	// Construct and Destruct
+	MappedFile()
+	{
+		data = NULL;
+		size = 0;
+		mapped = false;
+		opened = false;
+	}
+	MappedFile(const string fileName, const MappedFileAccess access = ACCESS_RANDOM)
+	{
+		data = NULL;
+		size = 0;
+		mapped = false;
+		opened = false;
+		open(fileName, access);
+	}
+	MappedFile(MappedFile &&other)
+	{
+		data = other.data;
+		size = other.size;
+		mapped = other.mapped;
+		opened = other.opened;
+		other.data = NULL;
+		other.size = 0;
+		other.mapped = false;
+		other.opened = false;
+	}
+	MappedFile& operator=(MappedFile &&other)
+	{
+		if(this != &other)
+		{
+			release();
+			data = other.data;
+			size = other.size;
+			mapped = other.mapped;
+			opened = other.opened;
+			other.data = NULL;
+			other.size = 0;
+			other.mapped = false;
+			other.opened = false;
+		}
+		return *this;
+	}
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+	~MappedFile()
+	{
+		release();
+	}
+
+	// open(): Maps a file, replacing any file already held.
+	// Params:	string; name or path of the file
+	//			MappedFileAccess; expected access pattern, passed on to the kernel as a hint
+	// Return:	bool; flag for if the file was opened. False if missing or unreadable.
+	bool open(const string fileName, const MappedFileAccess access = ACCESS_RANDOM)
+	{
+		release();
+
+		#ifdef MAPPEDFILE_MMAP
+		// Map file, References: https://man7.org/linux/man-pages/man2/mmap.2.html
+		int fd = ::open(fileName.c_str(), O_RDONLY);
+		if(fd < 0)
+		{
+			return false;
+		}
+		struct stat fileStat;
+		if(fstat(fd, &fileStat) != 0)
+		{
+			::close(fd);
+			return false;
+		}
+		size = (uint64_t)fileStat.st_size;
+		if(size == 0)
+		{
+			::close(fd);
+			opened = true;
+			return true;
+		}
+		void* mapping = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd); // mapping keeps its own reference to the file
+		if(mapping == MAP_FAILED)
+		{
+			size = 0;
+			return false;
+		}
+		madvise(mapping, size, (access == ACCESS_SEQUENTIAL) ? MADV_SEQUENTIAL : MADV_RANDOM); // Reference: https://man7.org/linux/man-pages/man2/madvise.2.html
+		data = (const unsigned char*)mapping;
+		mapped = true;
+		opened = true;
+		return true;
+		#else
+		// Read whole file into buffer, Reference: http://www.cplusplus.com/reference/istream/istream/read/
+		(void)access;
+		ifstream fileStream;
+		fileStream.open(fileName, ifstream::binary | ifstream::in);
+		if(fileStream.is_open() == false)
+		{
+			return false;
+		}
+		fileStream.seekg(0, fileStream.end);
+		size = (uint64_t)fileStream.tellg();
+		fileStream.seekg(0, fileStream.beg);
+		unsigned char* buffer = new unsigned char[size];
+		fileStream.read((char*)buffer, size);
+		fileStream.close();
+		data = buffer;
+		opened = true;
+		return true;
+		#endif
+	}
+
+	// close(): Releases the mapping (or buffer).
+	void close()
+	{
+		release();
+	}
+
+	// adviseWillNeed(): Hints that a range is about to be read, so the kernel can start reading it in.
+	void adviseWillNeed(const uint64_t offset, const uint64_t length) const
+	{
+		#ifdef MAPPEDFILE_MMAP
+		if(mapped == true && offset < size)
+		{
+			uint64_t pageSize = (uint64_t)sysconf(_SC_PAGESIZE);
+			uint64_t start = offset - (offset % pageSize);
+			uint64_t end = (offset + length < size) ? (offset + length) : size;
+			madvise((void*)(data + start), end - start, MADV_WILLNEED);
+		}
+		#else
+		(void)offset;
+		(void)length;
+		#endif
+	}
+
+	// Getters
+	const unsigned char* getData() const { return data; }
+	uint64_t getSize() const { return size; }
+	bool isOpen() const { return opened; }
+};
+
+#endif
@@ -0,0 +1,633 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: workStealingPool.h
+// Multi-buffer md5, hashing many independent messages at once with one message per simd lane.
+// REFERENCES:
+// - md5 message digest algorithm, Reference: https://www.ietf.org/rfc/rfc1321.txt
+// - Multi-buffer hashing, Reference: https://www.intel.com/content/dam/www/public/us/en/documents/white-papers/communications-ia-multi-buffer-paper.pdf
+// - SSE2 and AVX2 intrinsics, Reference: https://software.intel.com/sites/landingpage/IntrinsicsGuide/
+
+#ifndef MULTIMD5_H
+#define MULTIMD5_H
+
+#include <cstring>
+#include <functional>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "workStealingPool.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MD5_X86_SIMD
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+const int MD5_BLOCK_SIZE = 64;                     // Bytes of message consumed per transform
+const int MD5_DIGEST_SIZE = 16;                    // Bytes of an md5 digest
+const int MD5_MAX_LANES = 8;                       // Most messages hashed side by side (avx2)
+const uint64_t MD5_TASK_SIZE = 4 * 1024 * 1024;    // Least bytes of messages hashed per task by hashMd5Jobs()
+const size_t MD5_TASK_JOBS = 4 * MD5_MAX_LANES;    // Least messages hashed per task, keeping lanes full
+const uint32_t MD5_INIT[4] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476}; // Initial state words
+const uint32_t MD5_K[64] = {                       // Per step constants, floor(abs(sin(i + 1)) * 2^32)
+	0xD76AA478, 0xE8C7B756, 0x242070DB, 0xC1BDCEEE, 0xF57C0FAF, 0x4787C62A, 0xA8304613, 0xFD469501,
+	0x698098D8, 0x8B44F7AF, 0xFFFF5BB1, 0x895CD7BE, 0x6B901122, 0xFD987193, 0xA679438E, 0x49B40821,
+	0xF61E2562, 0xC040B340, 0x265E5A51, 0xE9B6C7AA, 0xD62F105D, 0x02441453, 0xD8A1E681, 0xE7D3FBC8,
+	0x21E1CDE6, 0xC33707D6, 0xF4D50D87, 0x455A14ED, 0xA9E3E905, 0xFCEFA3F8, 0x676F02D9, 0x8D2A4C8A,
+	0xFFFA3942, 0x8771F681, 0x6D9D6122, 0xFDE5380C, 0xA4BEEA44, 0x4BDECFA9, 0xF6BB4B60, 0xBEBFBC70,
+	0x289B7EC6, 0xEAA127FA, 0xD4EF3085, 0x04881D05, 0xD9D4D039, 0xE6DB99E5, 0x1FA27CF8, 0xC4AC5665,
+	0xF4292244, 0x432AFF97, 0xAB9423A7, 0xFC93A039, 0x655B59C3, 0x8F0CCC92, 0xFFEFF47D, 0x85845DD1,
+	0x6FA87E4F, 0xFE2CE6E0, 0xA3014314, 0x4E0811A1, 0xF7537E82, 0xBD3AF235, 0x2AD7D2BB, 0xEB86D391};
+const int MD5_SHIFT[64] = {                        // Per step left rotations
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20, 5, 9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21};
+const int MD5_WORD[64] = {                         // Per step message word
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	1, 6, 11, 0, 5, 10, 15, 4, 9, 14, 3, 8, 13, 2, 7, 12,
+	5, 8, 11, 14, 1, 4, 7, 10, 13, 0, 3, 6, 9, 12, 15, 2,
+	0, 7, 14, 5, 12, 3, 10, 1, 8, 15, 6, 13, 4, 11, 2, 9};
+
+/***********************/
+/******* Structs *******/
+// Md5Job: One message hashed by hashMd5Jobs(), a head then a body, both read in place. The head lets a few
+// leading bytes be replaced without copying the body (e.g. a repaired jpeg header), and may be empty.
+struct Md5Job {
+	const unsigned char* head;				// Leading bytes of the message
+	uint64_t headSize;						// Length of the head
+	const unsigned char* body;				// Remaining bytes of the message
+	uint64_t bodySize;						// Length of the body
+	unsigned char digest[MD5_DIGEST_SIZE];	// Digest, set once hashed
+
+	Md5Job()
+	{
+		head = NULL;
+		headSize = 0;
+		body = NULL;
+		bodySize = 0;
+		memset(digest, 0, MD5_DIGEST_SIZE);
+	}
+	Md5Job(const unsigned char* newBody, const uint64_t newBodySize)
+	{
+		head = NULL;
+		headSize = 0;
+		body = newBody;
+		bodySize = newBodySize;
+		memset(digest, 0, MD5_DIGEST_SIZE);
+	}
+	Md5Job(const unsigned char* newHead, const uint64_t newHeadSize, const unsigned char* newBody, const uint64_t newBodySize)
+	{
+		head = newHead;
+		headSize = newHeadSize;
+		body = newBody;
+		bodySize = newBodySize;
+		memset(digest, 0, MD5_DIGEST_SIZE);
+	}
+};
+
+// Md5LaneTransform: Function running one md5 transform in each of its lanes. State words are stored
+// lane by lane per word (state[word * lanes + lane]), and each lane reads its own 64 byte block.
+typedef void (*Md5LaneTransform)(uint32_t* state, const unsigned char* const* blocks);
+
+// Md5RunHandler: Function called by hashMd5Jobs() with the first index and number of a run of jobs once
+// they are hashed, on the thread that hashed them.
+typedef function<void(size_t, size_t)> Md5RunHandler;
+
+/***********************/
+/******* Utility *******/
+// md5NumBlocks(): Number of blocks in a padded message, the message then 0x80, zeros and its 8 byte bit length.
+uint64_t md5NumBlocks(const uint64_t length)
+{
+	return (length + 8) / MD5_BLOCK_SIZE + 1;
+}
+
+// md5Block(): A block of a job's padded message. Blocks lying wholly within the head or body are read in
+// place, and those straddling the two or holding padding are assembled in scratch.
+// Params:	Md5Job; job hashed
+//			uint64_t; block number
+//			unsigned char*; 64 bytes of scratch space
+// Return:	const unsigned char*; the block's 64 bytes
+const unsigned char* md5Block(const Md5Job &job, const uint64_t block, unsigned char* scratch)
+{
+	const uint64_t pos = block * MD5_BLOCK_SIZE;
+	const uint64_t length = job.headSize + job.bodySize;
+	if(pos + MD5_BLOCK_SIZE <= job.headSize)
+	{
+		return job.head + pos;
+	}
+	if(pos >= job.headSize && pos + MD5_BLOCK_SIZE <= length)
+	{
+		return job.body + (pos - job.headSize);
+	}
+
+	memset(scratch, 0, MD5_BLOCK_SIZE);
+	uint64_t filled = 0;
+	if(pos < job.headSize)
+	{
+		filled = job.headSize - pos;
+		memcpy(scratch, job.head + pos, filled);
+	}
+	if(pos + filled < length)
+	{
+		uint64_t bodyBytes = length - pos - filled;
+		bodyBytes = (bodyBytes < MD5_BLOCK_SIZE - filled) ? bodyBytes : MD5_BLOCK_SIZE - filled;
+		memcpy(scratch + filled, job.body + (pos + filled - job.headSize), bodyBytes);
+	}
+	if(length >= pos && length - pos < MD5_BLOCK_SIZE)
+	{
+		scratch[length - pos] = 0x80;
+	}
+	if(block + 1 == md5NumBlocks(length))
+	{
+		uint64_t bits = length * 8;
+		for(int i = 0; i < 8; i++)
+		{
+			scratch[MD5_BLOCK_SIZE - 8 + i] = (unsigned char)(bits >> (8 * i));
+		}
+	}
+
+	return scratch;
+}
+
+// md5Digest(): Writes a state's four words out as a digest, least significant byte first.
+void md5Digest(const uint32_t* state, const size_t stride, unsigned char* digest)
+{
+	for(int w = 0; w < 4; w++)
+	{
+		for(int i = 0; i < 4; i++)
+		{
+			digest[4 * w + i] = (unsigned char)(state[w * stride] >> (8 * i));
+		}
+	}
+}
+
+// md5HexDigest(): Digest as lower case hex, the form given by md5() and MD5::hexdigest().
+string md5HexDigest(const unsigned char* digest)
+{
+	char hex[2 * MD5_DIGEST_SIZE + 1];
+	for(int i = 0; i < MD5_DIGEST_SIZE; i++)
+	{
+		sprintf(hex + 2 * i, "%02x", digest[i]);
+	}
+
+	return string(hex, 2 * MD5_DIGEST_SIZE);
+}
+
+/***********************/
+/***** Procedures ******/
+// md5Step(): One md5 step, b + ((a + f + k + w) <<< s).
+inline uint32_t md5Step(const uint32_t a, const uint32_t b, const uint32_t f, const int i, const uint32_t* w)
+{
+	uint32_t x = a + f + MD5_K[i] + w[MD5_WORD[i]];
+	return b + ((x << MD5_SHIFT[i]) | (x >> (32 - MD5_SHIFT[i])));
+}
+
+// md5TransformScalar(): Portable md5 transform of one block. Each round's steps are unrolled so step
+// constants, rotations and message word choices fold away.
+void md5TransformScalar(uint32_t* state, const unsigned char* block)
+{
+	uint32_t w[16];
+	for(int j = 0; j < 16; j++)
+	{
+		w[j] = (uint32_t)block[4 * j] | ((uint32_t)block[4 * j + 1] << 8) | ((uint32_t)block[4 * j + 2] << 16) | ((uint32_t)block[4 * j + 3] << 24);
+	}
+
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	#pragma GCC unroll 16
+	for(int i = 0; i < 16; i++) // F, round 1
+	{
+		uint32_t f = d ^ (b & (c ^ d));
+		uint32_t previousD = d;
+		d = c;
+		c = b;
+		b = md5Step(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 16; i < 32; i++) // G, round 2
+	{
+		uint32_t f = c ^ (d & (b ^ c));
+		uint32_t previousD = d;
+		d = c;
+		c = b;
+		b = md5Step(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 32; i < 48; i++) // H, round 3
+	{
+		uint32_t f = b ^ c ^ d;
+		uint32_t previousD = d;
+		d = c;
+		c = b;
+		b = md5Step(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 48; i < 64; i++) // I, round 4
+	{
+		uint32_t f = c ^ (b | ~d);
+		uint32_t previousD = d;
+		d = c;
+		c = b;
+		b = md5Step(a, b, f, i, w);
+		a = previousD;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+}
+
+// hashMd5Scalar(): Hashes one job a block at a time, the serial path.
+void hashMd5Scalar(Md5Job &job)
+{
+	uint32_t state[4] = {MD5_INIT[0], MD5_INIT[1], MD5_INIT[2], MD5_INIT[3]};
+	unsigned char scratch[MD5_BLOCK_SIZE];
+	uint64_t numBlocks = md5NumBlocks(job.headSize + job.bodySize);
+	for(uint64_t b = 0; b < numBlocks; b++)
+	{
+		md5TransformScalar(state, md5Block(job, b, scratch));
+	}
+	md5Digest(state, 1, job.digest);
+}
+
+#ifdef MD5_X86_SIMD
+// md5StepSSE2(): One md5 step in each of 4 lanes, b + ((a + f + k + w) <<< s).
+__attribute__((target("sse2")))
+inline __m128i md5StepSSE2(const __m128i a, const __m128i b, const __m128i f, const int i, const __m128i* w)
+{
+	__m128i x = _mm_add_epi32(_mm_add_epi32(a, f), _mm_add_epi32(_mm_set1_epi32((int)MD5_K[i]), w[MD5_WORD[i]]));
+	x = _mm_or_si128(_mm_slli_epi32(x, MD5_SHIFT[i]), _mm_srli_epi32(x, 32 - MD5_SHIFT[i]));
+	return _mm_add_epi32(b, x);
+}
+
+// md5TransformSSE2(): Md5 transform of 4 blocks at once, one per 32 bit lane. Each 16 bytes of the
+// blocks are loaded and transposed so a register holds the same message word of every block.
+__attribute__((target("sse2")))
+void md5TransformSSE2(uint32_t* state, const unsigned char* const* blocks)
+{
+	__m128i w[16];
+	for(int q = 0; q < 4; q++)
+	{
+		__m128i r0 = _mm_loadu_si128((const __m128i*)(blocks[0] + 16 * q));
+		__m128i r1 = _mm_loadu_si128((const __m128i*)(blocks[1] + 16 * q));
+		__m128i r2 = _mm_loadu_si128((const __m128i*)(blocks[2] + 16 * q));
+		__m128i r3 = _mm_loadu_si128((const __m128i*)(blocks[3] + 16 * q));
+		__m128i t0 = _mm_unpacklo_epi32(r0, r1);
+		__m128i t1 = _mm_unpackhi_epi32(r0, r1);
+		__m128i t2 = _mm_unpacklo_epi32(r2, r3);
+		__m128i t3 = _mm_unpackhi_epi32(r2, r3);
+		w[4 * q] = _mm_unpacklo_epi64(t0, t2);
+		w[4 * q + 1] = _mm_unpackhi_epi64(t0, t2);
+		w[4 * q + 2] = _mm_unpacklo_epi64(t1, t3);
+		w[4 * q + 3] = _mm_unpackhi_epi64(t1, t3);
+	}
+
+	const __m128i ones = _mm_set1_epi32(-1);
+	__m128i a = _mm_loadu_si128((const __m128i*)(state));
+	__m128i b = _mm_loadu_si128((const __m128i*)(state + 4));
+	__m128i c = _mm_loadu_si128((const __m128i*)(state + 8));
+	__m128i d = _mm_loadu_si128((const __m128i*)(state + 12));
+	const __m128i startA = a, startB = b, startC = c, startD = d;
+	#pragma GCC unroll 16
+	for(int i = 0; i < 16; i++) // F, round 1
+	{
+		__m128i f = _mm_xor_si128(d, _mm_and_si128(b, _mm_xor_si128(c, d)));
+		__m128i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepSSE2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 16; i < 32; i++) // G, round 2
+	{
+		__m128i f = _mm_xor_si128(c, _mm_and_si128(d, _mm_xor_si128(b, c)));
+		__m128i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepSSE2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 32; i < 48; i++) // H, round 3
+	{
+		__m128i f = _mm_xor_si128(_mm_xor_si128(b, c), d);
+		__m128i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepSSE2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 48; i < 64; i++) // I, round 4
+	{
+		__m128i f = _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ones)));
+		__m128i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepSSE2(a, b, f, i, w);
+		a = previousD;
+	}
+	_mm_storeu_si128((__m128i*)(state), _mm_add_epi32(a, startA));
+	_mm_storeu_si128((__m128i*)(state + 4), _mm_add_epi32(b, startB));
+	_mm_storeu_si128((__m128i*)(state + 8), _mm_add_epi32(c, startC));
+	_mm_storeu_si128((__m128i*)(state + 12), _mm_add_epi32(d, startD));
+}
+
+// md5StepAVX2(): One md5 step in each of 8 lanes, b + ((a + f + k + w) <<< s).
+__attribute__((target("avx2")))
+inline __m256i md5StepAVX2(const __m256i a, const __m256i b, const __m256i f, const int i, const __m256i* w)
+{
+	__m256i x = _mm256_add_epi32(_mm256_add_epi32(a, f), _mm256_add_epi32(_mm256_set1_epi32((int)MD5_K[i]), w[MD5_WORD[i]]));
+	x = _mm256_or_si256(_mm256_slli_epi32(x, MD5_SHIFT[i]), _mm256_srli_epi32(x, 32 - MD5_SHIFT[i]));
+	return _mm256_add_epi32(b, x);
+}
+
+// md5TransformAVX2(): Md5 transform of 8 blocks at once, one per 32 bit lane. Each 32 bytes of the
+// blocks are loaded and transposed so a register holds the same message word of every block.
+__attribute__((target("avx2")))
+void md5TransformAVX2(uint32_t* state, const unsigned char* const* blocks)
+{
+	__m256i w[16];
+	for(int h = 0; h < 2; h++)
+	{
+		__m256i r[8];
+		for(int l = 0; l < 8; l++)
+		{
+			r[l] = _mm256_loadu_si256((const __m256i*)(blocks[l] + 32 * h));
+		}
+		__m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+		__m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+		__m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+		__m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+		__m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+		__m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+		__m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+		__m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+		__m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+		__m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+		__m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+		__m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+		__m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+		__m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+		__m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+		__m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+		w[8 * h] = _mm256_permute2x128_si256(u0, u4, 0x20);
+		w[8 * h + 1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+		w[8 * h + 2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+		w[8 * h + 3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+		w[8 * h + 4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+		w[8 * h + 5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+		w[8 * h + 6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+		w[8 * h + 7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+	}
+
+	const __m256i ones = _mm256_set1_epi32(-1);
+	__m256i a = _mm256_loadu_si256((const __m256i*)(state));
+	__m256i b = _mm256_loadu_si256((const __m256i*)(state + 8));
+	__m256i c = _mm256_loadu_si256((const __m256i*)(state + 16));
+	__m256i d = _mm256_loadu_si256((const __m256i*)(state + 24));
+	const __m256i startA = a, startB = b, startC = c, startD = d;
+	#pragma GCC unroll 16
+	for(int i = 0; i < 16; i++) // F, round 1
+	{
+		__m256i f = _mm256_xor_si256(d, _mm256_and_si256(b, _mm256_xor_si256(c, d)));
+		__m256i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepAVX2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 16; i < 32; i++) // G, round 2
+	{
+		__m256i f = _mm256_xor_si256(c, _mm256_and_si256(d, _mm256_xor_si256(b, c)));
+		__m256i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepAVX2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 32; i < 48; i++) // H, round 3
+	{
+		__m256i f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+		__m256i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepAVX2(a, b, f, i, w);
+		a = previousD;
+	}
+	#pragma GCC unroll 16
+	for(int i = 48; i < 64; i++) // I, round 4
+	{
+		__m256i f = _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ones)));
+		__m256i previousD = d;
+		d = c;
+		c = b;
+		b = md5StepAVX2(a, b, f, i, w);
+		a = previousD;
+	}
+	_mm256_storeu_si256((__m256i*)(state), _mm256_add_epi32(a, startA));
+	_mm256_storeu_si256((__m256i*)(state + 8), _mm256_add_epi32(b, startB));
+	_mm256_storeu_si256((__m256i*)(state + 16), _mm256_add_epi32(c, startC));
+	_mm256_storeu_si256((__m256i*)(state + 24), _mm256_add_epi32(d, startD));
+}
+#endif
+
+// getMd5LanesName(): Name of the lane transform chosen for this cpu.
+// Return: const char*; "avx2", "sse2" or "scalar".
+const char* getMd5LanesName()
+{
+#ifdef MD5_X86_SIMD
+	if(__builtin_cpu_supports("avx2"))
+	{
+		return "avx2";
+	}
+	if(__builtin_cpu_supports("sse2"))
+	{
+		return "sse2";
+	}
+#endif
+	return "scalar";
+}
+
+// hashMd5Lanes(): Hashes jobs side by side, one job per lane of a lane transform. A lane takes the next job
+// as soon as its own finishes, so lanes stay full over any mix of sizes. Once too few jobs remain to keep
+// the lanes worth running, each is finished on its own with the scalar transform.
+// Params:	Md5Job*; jobs hashed, digests set
+//			size_t; number of jobs
+//			int; number of lanes, at most MD5_MAX_LANES
+//			Md5LaneTransform; transform of that many lanes
+void hashMd5Lanes(Md5Job* jobs, const size_t numJobs, const int numLanes, const Md5LaneTransform transform)
+{
+	static const unsigned char idleBlock[MD5_BLOCK_SIZE] = {0};
+	uint32_t state[4 * MD5_MAX_LANES];
+	const unsigned char* blocks[MD5_MAX_LANES];
+	unsigned char scratch[MD5_MAX_LANES][MD5_BLOCK_SIZE];
+	Md5Job* laneJobs[MD5_MAX_LANES];
+	uint64_t laneBlocks[MD5_MAX_LANES];	// Next block of each lane's job
+	uint64_t laneEnds[MD5_MAX_LANES];	// Number of blocks in each lane's job
+	for(int l = 0; l < numLanes; l++)
+	{
+		laneJobs[l] = NULL;
+		blocks[l] = idleBlock;
+	}
+
+	size_t nextJob = 0;
+	int active = 0;
+	while(true)
+	{
+		// Refill idle lanes
+		for(int l = 0; l < numLanes && nextJob < numJobs; l++)
+		{
+			if(laneJobs[l] == NULL)
+			{
+				laneJobs[l] = &jobs[nextJob++];
+				laneBlocks[l] = 0;
+				laneEnds[l] = md5NumBlocks(laneJobs[l]->headSize + laneJobs[l]->bodySize);
+				for(int w = 0; w < 4; w++)
+				{
+					state[w * numLanes + l] = MD5_INIT[w];
+				}
+				active++;
+			}
+		}
+		if(active == 0 || (nextJob == numJobs && active * 4 <= numLanes))
+		{
+			break;
+		}
+
+		// Run until the first lane finishes, idle lanes hashing a dummy block
+		uint64_t burst = UINT64_MAX;
+		for(int l = 0; l < numLanes; l++)
+		{
+			if(laneJobs[l] != NULL && laneEnds[l] - laneBlocks[l] < burst)
+			{
+				burst = laneEnds[l] - laneBlocks[l];
+			}
+		}
+		for(uint64_t k = 0; k < burst; k++)
+		{
+			for(int l = 0; l < numLanes; l++)
+			{
+				if(laneJobs[l] != NULL)
+				{
+					blocks[l] = md5Block(*laneJobs[l], laneBlocks[l] + k, scratch[l]);
+				}
+			}
+			transform(state, blocks);
+		}
+		for(int l = 0; l < numLanes; l++)
+		{
+			if(laneJobs[l] != NULL)
+			{
+				laneBlocks[l] += burst;
+				if(laneBlocks[l] == laneEnds[l])
+				{
+					md5Digest(state + l, numLanes, laneJobs[l]->digest);
+					laneJobs[l] = NULL;
+					blocks[l] = idleBlock;
+					active--;
+				}
+			}
+		}
+	}
+
+	// Finish the few jobs left one at a time
+	for(int l = 0; l < numLanes; l++)
+	{
+		if(laneJobs[l] != NULL)
+		{
+			uint32_t laneState[4];
+			for(int w = 0; w < 4; w++)
+			{
+				laneState[w] = state[w * numLanes + l];
+			}
+			for(uint64_t b = laneBlocks[l]; b < laneEnds[l]; b++)
+			{
+				md5TransformScalar(laneState, md5Block(*laneJobs[l], b, scratch[l]));
+			}
+			md5Digest(laneState, 1, laneJobs[l]->digest);
+		}
+	}
+}
+
+// hashMd5Batch(): Hashes a run of jobs with the widest lane transform the cpu supports.
+void hashMd5Batch(Md5Job* jobs, const size_t numJobs)
+{
+#ifdef MD5_X86_SIMD
+	static const char* name = getMd5LanesName();
+	if(strcmp(name, "avx2") == 0)
+	{
+		hashMd5Lanes(jobs, numJobs, 8, md5TransformAVX2);
+		return;
+	}
+	if(strcmp(name, "sse2") == 0)
+	{
+		hashMd5Lanes(jobs, numJobs, 4, md5TransformSSE2);
+		return;
+	}
+#endif
+	for(size_t j = 0; j < numJobs; j++)
+	{
+		hashMd5Scalar(jobs[j]);
+	}
+}
+
+// hashMd5Jobs(): Hashes every job, runs of at least MD5_TASK_JOBS jobs and MD5_TASK_SIZE bytes spread across
+// threads and each run hashed side by side in simd lanes. Digests match md5() of each job's head and body joined.
+// Params:	vector<Md5Job>; jobs hashed, digests set
+//			unsigned int; number of threads
+//			Md5RunHandler; optional, called as each run is hashed
+void hashMd5Jobs(vector<Md5Job> &jobs, const unsigned int numThreads, const Md5RunHandler &runDone = nullptr)
+{
+	// Split into runs of jobs
+	vector<size_t> runStarts;
+	uint64_t runSize = MD5_TASK_SIZE;
+	for(size_t j = 0; j < jobs.size(); j++)
+	{
+		if(runSize >= MD5_TASK_SIZE && (runStarts.empty() || j - runStarts.back() >= MD5_TASK_JOBS))
+		{
+			runStarts.push_back(j);
+			runSize = 0;
+		}
+		runSize += jobs[j].headSize + jobs[j].bodySize;
+	}
+	runStarts.push_back(jobs.size());
+
+	if(numThreads <= 1 || runStarts.size() <= 2)
+	{
+		hashMd5Batch(jobs.data(), jobs.size());
+		if(runDone)
+		{
+			runDone(0, jobs.size());
+		}
+		return;
+	}
+	WorkStealingPool pool(numThreads);
+	for(size_t r = 0; r + 1 < runStarts.size(); r++)
+	{
+		size_t runStart = runStarts[r];
+		size_t runLength = runStarts[r + 1] - runStarts[r];
+		Md5Job* run = jobs.data() + runStart;
+		pool.add([run, runStart, runLength, &runDone]() {
+			hashMd5Batch(run, runLength);
+			if(runDone)
+			{
+				runDone(runStart, runLength);
+			}
+		});
+	}
+	pool.run();
+}
+
+#endif
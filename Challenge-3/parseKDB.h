@@ -1,6 +1,6 @@
 // David Ramsey
 // Last updated 01/31/2021
-// Dependencies: lsfr.h
+// Dependencies: lsfr.h keystreamCache.h mappedFile.h workStealingPool.h
 // REFERENCES: None, only provided materials used. **Reading in file, and output formatting moved to repairJpeg.cpp for Challenge-3**
 
 #ifndef PARSEKDB_H
@@ -8,10 +8,17 @@
 
 #include <iostream>
 #include <string>
+#include <cstring>
 #include <stdint.h>
 #include <vector>
+#include <memory>
+#include <algorithm>
+#include <functional>
 
 #include "lfsr.h"
+#include "keystreamCache.h"
+#include "mappedFile.h"
+#include "workStealingPool.h"
 
 using namespace std;
 
@@ -24,6 +31,19 @@ const int32_t LIST_TERMINATOR = 0xFFFFFFFF;	// Terminator value for kdb block li
 const int MAX_ENTRY_NAME = 16;				// Maximum length of an entry name (including null terminator)
 const unsigned int DECRYPT_KEY = 0x4F574154;// Given key for decrypting kdb data
 const int BYTE = 8;							// Number of bits within a byte
+const uint64_t DECODE_TASK_BYTES = 1024 * 1024;	// Most entry bytes gathered and decrypted by one parallel decode task
+const size_t STREAM_CHUNK_SIZE = 64 * 1024;			// Default chunk size of streamEntry()
+const uint64_t MAX_PARSED_ENTRY = 0x7FFFFFFF;		// Largest entry parseKDB() can hold (Entry sizes are int32_t)
+enum KdbErrorCode {
+	KDB_OK,							// File is well formed
+	KDB_TRUNCATED_HEADER,			// File too short for magic bytes and entry list position
+	KDB_ENTRY_LIST_OUT_OF_BOUNDS,	// Entry list runs past the end of the file (or has no terminator)
+	KDB_BLOCK_LIST_OUT_OF_BOUNDS,	// Block list runs past the end of the file (or has no terminator)
+	KDB_BAD_BLOCK_SIZE,				// Block size is negative
+	KDB_BLOCK_DATA_OUT_OF_BOUNDS,	// Block data runs past the end of the file
+	KDB_ENTRY_TOO_LARGE,			// Entry data larger than MAX_PARSED_ENTRY
+	KDB_OVERLAP						// Lists or block data overlap each other (e.g. two entries share a block list)
+};
 
 /***********************/
 /******* Structs *******/
@@ -38,23 +58,70 @@ struct Entry {
 	int32_t size;
 };
 
+struct BlockView {
+	const unsigned char* data;	// Start of the block's data within the kdb buffer (iovec style base)
+	size_t size;				// Length of the block's data
+};
+
+struct EntryDescriptor {
+	string name;					// Entry name
+	vector<BlockView> views;		// View of each block, in list order
+	vector<uint64_t> viewOffsets;	// Offset of each block's data within the entry
+	uint64_t size;					// Total data size of the entry
+};
+
+struct DecodeRange {
+	size_t entry;		// Position of the entry within the entry list
+	uint64_t start;		// First entry byte to decode
+	uint64_t end;		// One past the last entry byte to decode
+};
+
+struct KdbName {
+	char bytes[MAX_ENTRY_NAME];	// Entry name, zero padded after its terminator so names compare as fixed 16 byte keys
+};
+
+struct KdbError {
+	KdbErrorCode code;	// What is wrong, KDB_OK if nothing
+	uint64_t position;	// File position of the record at fault (entry, block, or header)
+	int64_t entry;		// Entry list position of the entry at fault, -1 if not within an entry
+};
+
+struct EntryInfo {
+	const char* name;		// Entry name, points into the kdb buffer (at most MAX_ENTRY_NAME bytes, null terminated if shorter)
+	uint32_t blockListPos;	// Offset of the entry's block list
+	uint32_t numBlocks;		// Number of blocks in the block list
+	uint64_t size;			// Total data size of the entry
+};
+
 /***********************/
 /*** Helper Functions **/
-// readLittleEndian(): Reads little endian formatted data from a buffer and converts it to big endian.
+// loadLittleEndian(): Loads a little endian integer with one unaligned native load. The bytes are
+// only swapped on big endian hosts. Templated for 1, 2, 4 and 8 byte integer types.
+// Params:	unsigned char*; position of the integer
+// Return:	class type (intended to be integer type); value in host byte order
+template<class T>
+T loadLittleEndian(const unsigned char* buffer)
+{
+	T value;
+	memcpy(&value, buffer, sizeof(T)); // compiles to a single load
+	#if defined(__BYTE_ORDER__) && (__BYTE_ORDER__ == __ORDER_BIG_ENDIAN__)
+	if(sizeof(T) == 2) value = (T)__builtin_bswap16((uint16_t)value);
+	if(sizeof(T) == 4) value = (T)__builtin_bswap32((uint32_t)value);
+	if(sizeof(T) == 8) value = (T)__builtin_bswap64((uint64_t)value);
+	#endif
+
+	return value;
+}
+
+// readLittleEndian(): Reads little endian formatted data from a buffer and converts it to host byte order.
 // Templated for integer types, undefined behavior for non-integer types.
 // Params: 	unsigned char*; buffer containing desired data
 // 			int32_t; offset position of desired data within buffer
-// Return:	class type (intended to be integer type); big endian conversion of desired data
+// Return:	class type (intended to be integer type); host byte order conversion of desired data
 template<class T>
 T readLittleEndian(const unsigned char* buffer, const int32_t startPos)
 {
-	T bigEndianValue = 0;
-	for(int i = 0; i < (int)sizeof(T); i++)
-	{
-		bigEndianValue += ((T)buffer[startPos + i]) << (i * BYTE);
-	}
-	
-	return bigEndianValue;	
+	return loadLittleEndian<T>(buffer + startPos);
 }
 
 // checkForListEnd(): Checks a position of a buffer for a list terminator (checks for list ending).
@@ -63,64 +130,441 @@ T readLittleEndian(const unsigned char* buffer, const int32_t startPos)
 // Return:	bool; flag for if list terminator is present. True if present, false if not found.
 bool checkForListEnd(const unsigned char* buffer, const int32_t startPos)
 {
-	// Read buffer value as big endian integer
-	int32_t nextBufferValue = 0x0;
-	for(int32_t i = (sizeof(int32_t) - 1); i >= 0; i--)
+	// Terminator is all ones, so byte order does not matter
+	uint32_t nextBufferValue = 0;
+	memcpy(&nextBufferValue, buffer + startPos, sizeof(uint32_t));
+	return (nextBufferValue == (uint32_t)LIST_TERMINATOR);
+}
+
+// decryptEntryData(): Decrypts gathered entry data in place with DECRYPT_KEY.
+// Every entry shares DECRYPT_KEY, so its keystream comes from the shared keystream cache. Entries
+// longer than the cache are split across threads instead when more than one thread is given.
+// Params:	unsigned char*; entry data
+//			size_t; length of entry data
+//			unsigned int; number of threads allowed for long entries
+void decryptEntryData(unsigned char* data, const size_t size, const unsigned int numThreads)
+{
+	KeystreamCache &keystreamCache = getSharedKeystreamCache();
+	if(numThreads > 1 && size > keystreamCache.getMaxLength())
 	{
-		nextBufferValue += ((int32_t)buffer[startPos + i]) << (BYTE * (sizeof(int32_t) - i));
+		CryptParallel(data, size, DECRYPT_KEY, numThreads);
 	}
-	
-	bool isEnd = (nextBufferValue == LIST_TERMINATOR);
-	return isEnd;
+	else
+	{
+		keystreamCache.cryptInPlace(data, size, DECRYPT_KEY);
+	}
+}
+
+// readOffset(): Reads an unsigned 32 bit little endian offset at any position of a buffer.
+// Params:	unsigned char*; buffer containing the offset
+//			uint64_t; position of the offset within buffer
+// Return:	uint32_t; offset value (LIST_TERMINATOR reads as 0xFFFFFFFF)
+uint32_t readOffset(const unsigned char* buffer, const uint64_t pos)
+{
+	return readLittleEndian<uint32_t>(buffer + pos, 0);
+}
+
+// readBlockRecord(): Reads the block record at a position of a block list, if it holds a usable block:
+// the record lies within bufferLen and is not the terminator, its size is not negative, and its data
+// lies within bufferLen. Anything else ends the list for every bounded walk.
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			uint64_t; position of the block record
+//			(OUT) uint64_t; size of the block's data
+//			(OUT) uint64_t; position of the block's data
+// Return:	bool; flag for if a usable block is there. False at the end of the list.
+bool readBlockRecord(const unsigned char* kdbBuffer, const uint64_t bufferLen, const uint64_t blockIndex, uint64_t &blockSize, uint64_t &dataPos)
+{
+	if(blockIndex + BLOCK_SIZE > bufferLen || readOffset(kdbBuffer, blockIndex) == (uint32_t)LIST_TERMINATOR)
+	{
+		return false;
+	}
+	int16_t size = readLittleEndian<int16_t>(kdbBuffer + blockIndex, 0);
+	dataPos = readOffset(kdbBuffer, blockIndex + sizeof(int16_t));
+	if(size < 0 || dataPos + (uint64_t)size > bufferLen)
+	{
+		return false;
+	}
+	blockSize = (uint64_t)size;
+
+	return true;
+}
+
+// readBlockViews(): Walks a block list once, recording a view of each block's data without copying it.
+// Blocks that continue straight on from the previous block in the file share one view, so a
+// compacted entry (see compactKDB()) is a single view.
+// Views can be handed to zero-copy consumers (e.g. writev), or gathered with gatherBlockViews().
+// Reads stop at bufferLen: the list ends at the last usable block (see readBlockRecord()).
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			uint64_t; position of the block list
+//			(OUT) vector<BlockView>; views of each run of adjacent blocks, in list order (previous contents are cleared)
+//			(OUT) uint32_t; number of blocks walked
+// Return:	uint64_t; total data size of the blocks
+uint64_t readBlockViews(const unsigned char* kdbBuffer, const uint64_t bufferLen, const uint64_t blockListPos, vector<BlockView> &views, uint32_t &numBlocks)
+{
+	uint64_t totalDataSize = 0;
+	uint64_t blockSize = 0;
+	uint64_t dataPos = 0;
+	views.clear();
+	numBlocks = 0;
+	for(uint64_t blockIndex = blockListPos; readBlockRecord(kdbBuffer, bufferLen, blockIndex, blockSize, dataPos) == true; blockIndex += BLOCK_SIZE)
+	{
+		BlockView newView;
+		newView.size = (size_t)blockSize;
+		newView.data = &kdbBuffer[dataPos];
+		if(views.empty() == false && views.back().data + views.back().size == newView.data)
+		{
+			views.back().size += newView.size;
+		}
+		else
+		{
+			views.push_back(newView);
+		}
+		totalDataSize += newView.size;
+		numBlocks++;
+	}
+
+	return totalDataSize;
+}
+uint64_t readBlockViews(const unsigned char* kdbBuffer, const uint64_t bufferLen, const uint64_t blockListPos, vector<BlockView> &views)
+{
+	uint32_t numBlocks = 0;
+	return readBlockViews(kdbBuffer, bufferLen, blockListPos, views, numBlocks);
+}
+
+// gatherBlockViews(): Copies the data of each block view into one buffer, a memcpy per block.
+// Params:	vector<BlockView>; views from readBlockViews()
+//			unsigned char*; destination, at least the total size of the views
+// Return:	uint64_t; number of bytes copied
+uint64_t gatherBlockViews(const vector<BlockView> &views, unsigned char* data)
+{
+	uint64_t readCount = 0;
+	for(size_t i = 0; i < views.size(); i++)
+	{
+		memcpy(&data[readCount], views[i].data, views[i].size);
+		readCount += views[i].size;
+	}
+
+	return readCount;
+}
+
+// decodeEntryRange(): Gathers and decrypts one byte range of an entry. The keystream is started at the
+// range's offset, so ranges of one entry can be decoded independently.
+// Params:	EntryDescriptor; entry being decoded
+//			unsigned char*; destination for the whole entry (only the range is written)
+//			uint64_t; first entry byte to decode
+//			uint64_t; one past the last entry byte to decode
+void decodeEntryRange(const EntryDescriptor &entry, unsigned char* data, const uint64_t start, const uint64_t end)
+{
+	// Copy the part of each block view within the range
+	size_t v = (size_t)(upper_bound(entry.viewOffsets.begin(), entry.viewOffsets.end(), start) - entry.viewOffsets.begin()) - 1;
+	for(uint64_t pos = start; pos < end; v++)
+	{
+		uint64_t viewPos = pos - entry.viewOffsets[v];
+		uint64_t length = entry.views[v].size - viewPos;
+		if(length > end - pos)
+		{
+			length = end - pos;
+		}
+		memcpy(&data[pos], entry.views[v].data + viewPos, length);
+		pos += length;
+	}
+
+	getSharedKeystreamCache().cryptAt(&data[start], &data[start], end - start, DECRYPT_KEY, start);
+}
+
+/***********************/
+/******* Classes *******/
+// LazyEntry: Handle to a kdb entry that holds only its name and block list position.
+// The block list is walked on the first size request, and the data is gathered and decrypted on the
+// first data request. Results are kept for later calls. The kdb buffer must outlive the handle.
+// The walk stops at bufferLen (see readBlockViews()). Not safe to load from multiple threads at once.
+class LazyEntry {
+private:
+	const unsigned char* kdbBuffer;		// Buffer holding the kdb file
+	uint64_t bufferLen;					// Length of the buffer
+	string name;						// Entry name
+	uint32_t blockListPos;				// Offset of the entry's block list
+	vector<BlockView> views;			// Views of the entry's blocks, valid once measured
+	uint64_t size;						// Total data size, valid once measured
+	bool measured;						// Flag for if the block list has been walked
+	unique_ptr<unsigned char[]> data;	// Decrypted data, NULL until loaded
+
+	void measure()
+	{
+		if(measured == false)
+		{
+			size = readBlockViews(kdbBuffer, bufferLen, blockListPos, views);
+			measured = true;
+		}
+	}
+
+public:
+	// Construct
+	LazyEntry(const unsigned char* newKdbBuffer, const uint64_t newBufferLen, const string newName, const uint32_t newBlockListPos)
+	{
+		kdbBuffer = newKdbBuffer;
+		bufferLen = newBufferLen;
+		name = newName;
+		blockListPos = newBlockListPos;
+		size = 0;
+		measured = false;
+	}
+
+	// getData(): Decrypted entry data, gathered and decrypted on first call.
+	// Return:	unsigned char*; getSize() bytes of data, owned by the handle
+	const unsigned char* getData()
+	{
+		if(data == NULL)
+		{
+			measure();
+			data.reset(new unsigned char[size]);
+			gatherBlockViews(views, data.get());
+			decryptEntryData(data.get(), size, 1);
+		}
+
+		return data.get();
+	}
+
+	// unload(): Frees decrypted data, it is reloaded on the next getData() call.
+	void unload() { data.reset(); }
+
+	// Getters
+	const string& getName() const { return name; }
+	uint32_t getBlockListPos() const { return blockListPos; }
+	uint64_t getSize() { measure(); return size; }
+	bool isLoaded() const { return data != NULL; }
+};
+
+// EntryStream: Pull reader yielding an entry's decrypted data in chunks of the caller's choosing.
+// Only the current block list position and lsfr key are kept between reads, so memory use does not
+// depend on entry size. The walk stops at bufferLen (see readBlockRecord()). The kdb buffer must outlive the stream.
+class EntryStream {
+private:
+	const unsigned char* kdbBuffer;	// Buffer holding the kdb file
+	uint64_t bufferLen;				// Length of the buffer
+	uint64_t blockIndex;			// Position of the current block within the block list
+	uint64_t blockSize;				// Data size of the current block
+	uint64_t dataPos;				// Data position of the current block
+	uint64_t blockRead;				// Bytes of the current block already read
+	unsigned int key;				// Key for the next entry byte, carried across reads
+	uint64_t offset;				// Entry bytes read so far
+	bool done;						// Flag for if the end of the block list has been reached
+
+public:
+	// Construct
+	EntryStream(const unsigned char* newKdbBuffer, const uint64_t newBufferLen, const uint64_t blockListPos)
+	{
+		kdbBuffer = newKdbBuffer;
+		bufferLen = newBufferLen;
+		blockIndex = blockListPos;
+		blockSize = 0;
+		dataPos = 0;
+		blockRead = 0;
+		key = getNewKey(DECRYPT_KEY);
+		offset = 0;
+		done = (readBlockRecord(kdbBuffer, bufferLen, blockIndex, blockSize, dataPos) == false);
+	}
+
+	// read(): Reads and decrypts the next chunk of entry data.
+	// Params:	unsigned char*; destination for the chunk
+	//			size_t; most bytes to read
+	// Return:	size_t; bytes read, less than chunkSize only at the end of the entry (0 once finished)
+	size_t read(unsigned char* chunk, const size_t chunkSize)
+	{
+		size_t readCount = 0;
+		while(readCount < chunkSize && done == false)
+		{
+			// Copy what fits from the current block
+			const unsigned char* blockData = &kdbBuffer[dataPos];
+			uint64_t length = blockSize - blockRead;
+			if(length > chunkSize - readCount)
+			{
+				length = chunkSize - readCount;
+			}
+			memcpy(&chunk[readCount], blockData + blockRead, length);
+			readCount += length;
+			blockRead += length;
+
+			// Move to next block once this one is used up
+			if(blockRead >= blockSize)
+			{
+				blockIndex += BLOCK_SIZE;
+				blockRead = 0;
+				done = (readBlockRecord(kdbBuffer, bufferLen, blockIndex, blockSize, dataPos) == false);
+			}
+		}
+
+		key = CryptFromKey(chunk, chunk, readCount, key);
+		offset += readCount;
+		return readCount;
+	}
+
+	// Getters
+	uint64_t getOffset() const { return offset; }
+	bool isDone() const { return done; }
+};
+
+// streamEntry(): Passes an entry's decrypted data to a callback one chunk at a time, using one chunk sized buffer.
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			uint64_t; position of the entry's block list
+//			function; called with each chunk and its length, returns false to stop early
+//			size_t; chunk size
+// Return:	uint64_t; total bytes passed to the callback
+uint64_t streamEntry(const unsigned char* kdbBuffer, const uint64_t bufferLen, const uint64_t blockListPos, function<bool(const unsigned char*, size_t)> callback, const size_t chunkSize = STREAM_CHUNK_SIZE)
+{
+	EntryStream stream(kdbBuffer, bufferLen, blockListPos);
+	vector<unsigned char> chunk(chunkSize);
+	size_t readCount = 0;
+	while((readCount = stream.read(chunk.data(), chunkSize)) > 0)
+	{
+		if(callback(chunk.data(), readCount) == false)
+		{
+			break;
+		}
+	}
+
+	return stream.getOffset();
 }
 
 /***********************/
 /******* Parsing *******/
-vector<Entry> parseKDB(const unsigned char* kdbBuffer, const int32_t bufferLen)
+// parseKDBParallel(): Reads and decrypts every entry of a kdb file across a work-stealing thread pool.
+// The entry list is walked first to collect each entry's block views. Entries are then cut into byte
+// ranges of at most DECODE_TASK_BYTES, and small ranges are batched, so tasks are sized by bytes rather
+// than by entries and one huge entry is shared between threads. Output matches parseKDB().
+// Entry and block list walks stop at bufferLen (see readBlockViews()), and an entry larger than
+// MAX_PARSED_ENTRY ends the list.
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			unsigned int; number of threads
+// Return:	vector<Entry>; decrypted entries, in entry list order. Caller owns each entry's data.
+vector<Entry> parseKDBParallel(const unsigned char* kdbBuffer, const uint64_t bufferLen, const unsigned int numThreads)
+{
+	if(bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+	{
+		return vector<Entry>();
+	}
+
+	// Collect entry descriptors
+	vector<EntryDescriptor> descriptors;
+	for(uint64_t entryIndex = readOffset(kdbBuffer, NUM_MAGIC_BYTES); entryIndex + ENTRY_SIZE <= bufferLen && readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+	{
+		descriptors.push_back(EntryDescriptor());
+		EntryDescriptor &entry = descriptors.back();
+		const char* entryName = (const char*)&kdbBuffer[entryIndex];
+		entry.name = string(entryName, strnlen(entryName, MAX_ENTRY_NAME));
+		entry.size = readBlockViews(kdbBuffer, bufferLen, readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME), entry.views);
+		if(entry.size > MAX_PARSED_ENTRY)
+		{
+			descriptors.pop_back();
+			break;
+		}
+
+		uint64_t viewOffset = 0;
+		for(size_t v = 0; v < entry.views.size(); v++)
+		{
+			entry.viewOffsets.push_back(viewOffset);
+			viewOffset += entry.views[v].size;
+		}
+	}
+
+	// Allocate output in list order
+	vector<Entry> entryList(descriptors.size());
+	for(size_t e = 0; e < descriptors.size(); e++)
+	{
+		entryList[e].name = descriptors[e].name;
+		entryList[e].size = (int32_t)descriptors[e].size;
+		entryList[e].data = new unsigned char[descriptors[e].size];
+	}
+
+	// Cut entries into byte ranges, batching ranges into tasks of about DECODE_TASK_BYTES
+	WorkStealingPool pool(numThreads);
+	vector<DecodeRange> batch;
+	uint64_t batchBytes = 0;
+	auto addBatch = [&]() {
+		pool.add([batch, &descriptors, &entryList]() {
+			for(size_t i = 0; i < batch.size(); i++)
+			{
+				decodeEntryRange(descriptors[batch[i].entry], entryList[batch[i].entry].data, batch[i].start, batch[i].end);
+			}
+		});
+		batch.clear();
+		batchBytes = 0;
+	};
+	for(size_t e = 0; e < descriptors.size(); e++)
+	{
+		for(uint64_t start = 0; start < descriptors[e].size; start += DECODE_TASK_BYTES)
+		{
+			DecodeRange range;
+			range.entry = e;
+			range.start = start;
+			range.end = (descriptors[e].size - start < DECODE_TASK_BYTES) ? descriptors[e].size : (start + DECODE_TASK_BYTES);
+			batch.push_back(range);
+			batchBytes += range.end - range.start;
+			if(batchBytes >= DECODE_TASK_BYTES)
+			{
+				addBatch();
+			}
+		}
+	}
+	if(batch.empty() == false)
+	{
+		addBatch();
+	}
+
+	pool.run();
+
+	return entryList;
+}
+
+// parseKDB(): Reads and decrypts every entry of a kdb file.
+// Entry and block list walks stop at bufferLen (see readBlockViews()), and an entry larger than
+// MAX_PARSED_ENTRY ends the list. Untrusted files should be checked first (see parseKDBChecked()).
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			unsigned int; number of threads, more than one decodes entries in parallel (see parseKDBParallel())
+// Return:	vector<Entry>; decrypted entries, in entry list order. Caller owns each entry's data.
+vector<Entry> parseKDB(const unsigned char* kdbBuffer, const uint64_t bufferLen, const unsigned int numThreads = 1)
 {
+	if(numThreads > 1)
+	{
+		return parseKDBParallel(kdbBuffer, bufferLen, numThreads);
+	}
+
+	vector<Entry> entryList;
+	if(bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+	{
+		return entryList;
+	}
+
 	// Read entry list position
-	int32_t entryListPos = readLittleEndian<int32_t>(kdbBuffer, NUM_MAGIC_BYTES);
+	uint64_t entryListPos = readOffset(kdbBuffer, NUM_MAGIC_BYTES);
 	
 	// Read entry list
-	vector<Entry> entryList;
-	int32_t entryIndex = entryListPos;
-	while(checkForListEnd(kdbBuffer, entryIndex) == false)
+	vector<BlockView> blockViews; // reused for every entry
+	uint64_t entryIndex = entryListPos;
+	while(entryIndex + ENTRY_SIZE <= bufferLen && readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR)
 	{
 		// Read entry name and position of block list
-		string entryName = (char*)&kdbBuffer[entryIndex];
-		int32_t blockListPos = readLittleEndian<int32_t>(kdbBuffer, (entryIndex + MAX_ENTRY_NAME));
+		const char* nameField = (const char*)&kdbBuffer[entryIndex];
+		string entryName(nameField, strnlen(nameField, MAX_ENTRY_NAME));
+		uint64_t blockListPos = readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME);
 		
-		// Read block list
-		vector<Block> blockList;
-		int32_t blockIndex = blockListPos;
-		int32_t totalDataSize = 0;
-		while(checkForListEnd(kdbBuffer, blockIndex) == false)
+		// Read block list, then collect block data into buffer
+		uint64_t blockDataSize = readBlockViews(kdbBuffer, bufferLen, blockListPos, blockViews);
+		if(blockDataSize > MAX_PARSED_ENTRY)
 		{
-			Block newBlock;
-			newBlock.size = readLittleEndian<int16_t>(kdbBuffer, blockIndex);
-			newBlock.dataPos = readLittleEndian<int32_t>(kdbBuffer, (blockIndex + sizeof(int16_t)));
-			blockList.push_back(newBlock);
-
-			totalDataSize += newBlock.size;
-			blockIndex += BLOCK_SIZE;
+			break;
 		}
-	
-		// Collect block data into buffer
+		int32_t totalDataSize = (int32_t)blockDataSize;
 		unsigned char* data = new unsigned char[totalDataSize];
-		int32_t numBlocks = (int32_t)blockList.size();
-		int32_t readCount = 0;
-		for(int32_t i = 0; i < numBlocks; i++)
-		{
-			Block readBlock = blockList.at(i);
-			for(int32_t k = 0; k < readBlock.size; k++)
-			{
-				data[readCount] = kdbBuffer[readBlock.dataPos + k];
-				readCount++;
-			}
-		}
+		gatherBlockViews(blockViews, data);
 
 		// Decrypt data
-		data = Crypt(data, totalDataSize, DECRYPT_KEY);
+		decryptEntryData(data, (size_t)totalDataSize, 1);
 	
 		// Store data and entry
 		Entry newEntry;
@@ -137,4 +581,468 @@ vector<Entry> parseKDB(const unsigned char* kdbBuffer, const int32_t bufferLen)
 	return entryList;
 }
 
+// parseKDBLazy(): Reads the entry list of a kdb file without reading any entry data.
+// Block lists are walked, and data decrypted, only as each handle is used. The entry list walk stops
+// at bufferLen, so an unterminated list ends at the last whole entry, and so do the handles' block list walks.
+// Params:	unsigned char*; buffer holding the kdb file, must outlive the returned handles
+//			uint64_t; length of the buffer
+// Return:	vector<LazyEntry>; entry handles, in entry list order
+vector<LazyEntry> parseKDBLazy(const unsigned char* kdbBuffer, const uint64_t bufferLen)
+{
+	vector<LazyEntry> entryList;
+	if(bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+	{
+		return entryList;
+	}
+	for(uint64_t entryIndex = readOffset(kdbBuffer, NUM_MAGIC_BYTES); entryIndex + ENTRY_SIZE <= bufferLen && readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+	{
+		const char* entryName = (const char*)&kdbBuffer[entryIndex];
+		entryList.push_back(LazyEntry(kdbBuffer, bufferLen, string(entryName, strnlen(entryName, MAX_ENTRY_NAME)), readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME)));
+	}
+
+	return entryList;
+}
+
+/***********************/
+/****** Validation *****/
+// getKdbErrorName(): Short description of a kdb error code.
+const char* getKdbErrorName(const KdbErrorCode code)
+{
+	switch(code)
+	{
+		case KDB_OK:						return "ok";
+		case KDB_TRUNCATED_HEADER:			return "truncated header";
+		case KDB_ENTRY_LIST_OUT_OF_BOUNDS:	return "entry list out of bounds";
+		case KDB_BLOCK_LIST_OUT_OF_BOUNDS:	return "block list out of bounds";
+		case KDB_BAD_BLOCK_SIZE:			return "negative block size";
+		case KDB_BLOCK_DATA_OUT_OF_BOUNDS:	return "block data out of bounds";
+		case KDB_ENTRY_TOO_LARGE:			return "entry too large";
+		case KDB_OVERLAP:					return "overlapping lists or data";
+	}
+	return "unknown";
+}
+
+// markRegion(): Marks a byte range in a bitmap of file bytes (one bit per byte).
+// Return:	bool; flag for if the range was free. False if any byte was already marked.
+bool markRegion(vector<uint64_t> &bitmap, const uint64_t start, const uint64_t end)
+{
+	bool isFree = true;
+	for(uint64_t pos = start; pos < end; )
+	{
+		uint64_t word = pos / 64;
+		uint64_t bit = pos % 64;
+		uint64_t count = (end - pos < 64 - bit) ? (end - pos) : (64 - bit);
+		uint64_t mask = (count == 64) ? ~0ull : (((1ull << count) - 1) << bit);
+		isFree = isFree && ((bitmap[word] & mask) == 0);
+		bitmap[word] |= mask;
+		pos += count;
+	}
+	return isFree;
+}
+
+// validateKDB(): Checks a kdb file is safe for the trusting parsers (parseKDB(), parseKDBLazy(), KdbReader),
+// without reading past bufferLen. Entry and block lists are walked once, every offset and size checked
+// against the buffer as it is read. Lists are arrays, so a walk can only fail to end by running off the
+// buffer, and as lists may not overlap, their total length can not pass bufferLen either. Walks are
+// stopped there, so validation is linear in the file size even when every entry points at one long list.
+// With checkOverlaps, each list and block's bytes are marked in a bitmap of the file (bufferLen / 8 bytes)
+// during the same walk, and any byte marked twice is reported. Names need no terminator, as every
+// parser reads at most MAX_ENTRY_NAME bytes of a name.
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			bool; flag for if overlapping lists and block data are checked for
+// Return:	KdbError; first problem found, code KDB_OK if none
+KdbError validateKDB(const unsigned char* kdbBuffer, const uint64_t bufferLen, const bool checkOverlaps = true)
+{
+	KdbError error = {KDB_OK, 0, -1};
+	if(kdbBuffer == NULL || bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+	{
+		error.code = KDB_TRUNCATED_HEADER;
+		return error;
+	}
+
+	vector<uint64_t> bitmap;
+	if(checkOverlaps == true)
+	{
+		bitmap.assign(bufferLen / 64 + 1, 0);
+		markRegion(bitmap, 0, (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t));
+	}
+	uint64_t entryListPos = readOffset(kdbBuffer, NUM_MAGIC_BYTES);
+	uint64_t listBytes = 0; // bytes of every block list walked so far, at most bufferLen unless lists overlap
+
+	uint64_t entryIndex = entryListPos;
+	for(int64_t e = 0; ; e++, entryIndex += ENTRY_SIZE)
+	{
+		error.position = entryIndex;
+		if(entryIndex + sizeof(uint32_t) > bufferLen)
+		{
+			error.code = KDB_ENTRY_LIST_OUT_OF_BOUNDS;
+			return error;
+		}
+		if(readOffset(kdbBuffer, entryIndex) == (uint32_t)LIST_TERMINATOR)
+		{
+			break;
+		}
+		error.entry = e;
+		if(entryIndex + ENTRY_SIZE > bufferLen)
+		{
+			error.code = KDB_ENTRY_LIST_OUT_OF_BOUNDS;
+			return error;
+		}
+
+		// Walk block list
+		uint64_t blockListPos = readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME);
+		uint64_t entrySize = 0;
+		uint64_t blockIndex = blockListPos;
+		for(; ; blockIndex += BLOCK_SIZE)
+		{
+			error.position = blockIndex;
+			if(blockIndex + sizeof(uint32_t) > bufferLen)
+			{
+				error.code = KDB_BLOCK_LIST_OUT_OF_BOUNDS;
+				return error;
+			}
+			if(readOffset(kdbBuffer, blockIndex) == (uint32_t)LIST_TERMINATOR)
+			{
+				break;
+			}
+			if(blockIndex + BLOCK_SIZE > bufferLen)
+			{
+				error.code = KDB_BLOCK_LIST_OUT_OF_BOUNDS;
+				return error;
+			}
+			if(listBytes + (blockIndex - blockListPos) > bufferLen)
+			{
+				error.code = KDB_OVERLAP;
+				return error;
+			}
+
+			int16_t blockSize = readLittleEndian<int16_t>(kdbBuffer + blockIndex, 0);
+			uint64_t dataPos = readOffset(kdbBuffer, blockIndex + sizeof(int16_t));
+			if(blockSize < 0)
+			{
+				error.code = KDB_BAD_BLOCK_SIZE;
+				return error;
+			}
+			if(dataPos + (uint64_t)blockSize > bufferLen)
+			{
+				error.code = KDB_BLOCK_DATA_OUT_OF_BOUNDS;
+				return error;
+			}
+			entrySize += (uint64_t)blockSize;
+			if(entrySize > MAX_PARSED_ENTRY)
+			{
+				error.code = KDB_ENTRY_TOO_LARGE;
+				return error;
+			}
+			if(checkOverlaps == true && markRegion(bitmap, dataPos, dataPos + (uint64_t)blockSize) == false)
+			{
+				error.code = KDB_OVERLAP;
+				return error;
+			}
+		}
+		listBytes += blockIndex + sizeof(uint32_t) - blockListPos;
+		if(checkOverlaps == true && markRegion(bitmap, blockListPos, blockIndex + sizeof(uint32_t)) == false)
+		{
+			error.code = KDB_OVERLAP;
+			error.position = entryIndex;
+			return error;
+		}
+	}
+	error.entry = -1;
+	if(checkOverlaps == true && markRegion(bitmap, entryListPos, entryIndex + sizeof(uint32_t)) == false)
+	{
+		error.code = KDB_OVERLAP;
+		error.position = NUM_MAGIC_BYTES;
+		return error;
+	}
+
+	error.position = 0;
+	return error;
+}
+
+// parseKDBChecked(): parseKDB() for untrusted files. The file is validated first (see validateKDB()),
+// and only parsed if well formed.
+// Params:	unsigned char*; buffer holding the kdb file
+//			uint64_t; length of the buffer
+//			(OUT) KdbError; result of validation
+//			unsigned int; number of threads for parseKDB()
+// Return:	vector<Entry>; decrypted entries, in entry list order, empty if the file is malformed. Caller owns each entry's data.
+vector<Entry> parseKDBChecked(const unsigned char* kdbBuffer, const uint64_t bufferLen, KdbError &error, const unsigned int numThreads = 1)
+{
+	error = validateKDB(kdbBuffer, bufferLen);
+	if(error.code != KDB_OK)
+	{
+		return vector<Entry>();
+	}
+
+	return parseKDB(kdbBuffer, bufferLen, numThreads);
+}
+
+/***********************/
+/******** Index ********/
+// KdbIndex: Name index over a kdb entry list. Names are stored inline as fixed 16 byte keys, in
+// entry list order, with an open addressing (linear probing) hash table from name to list position.
+// Built in one pass over the entry list, and find() does not allocate.
+class KdbIndex {
+private:
+	vector<KdbName> names;			// Entry names, in entry list order
+	vector<uint32_t> blockListPos;	// Block list position of each entry
+	vector<uint32_t> slots;			// Hash table, entry position + 1 per slot, 0 for an empty slot
+	uint64_t slotMask;				// Number of slots - 1, slots are a power of two
+
+	// hashName(): Hash of a fixed 16 byte name key.
+	static uint64_t hashName(const KdbName &name)
+	{
+		uint64_t low = 0;
+		uint64_t high = 0;
+		memcpy(&low, name.bytes, sizeof(low));
+		memcpy(&high, name.bytes + sizeof(low), sizeof(high));
+		// Mix both halves through a 64 bit finalizer, so every name byte reaches the low (slot) bits
+		uint64_t hash = low ^ ((high + 0x9E3779B97F4A7C15ull) * 0xBF58476D1CE4E5B9ull);
+		hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+		hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+		return hash ^ (hash >> 31);
+	}
+
+	// makeKey(): Fixed 16 byte key for a name, false if the name is too long to be an entry name.
+	static bool makeKey(const char* name, const size_t length, KdbName &key)
+	{
+		if(length > (size_t)MAX_ENTRY_NAME)
+		{
+			return false;
+		}
+		memset(key.bytes, 0, MAX_ENTRY_NAME);
+		memcpy(key.bytes, name, length);
+		return true;
+	}
+
+	// insert(): Adds an entry position to the hash table. Earlier entries win for duplicate names.
+	void insert(const uint32_t position)
+	{
+		for(uint64_t slot = hashName(names[position]) & slotMask; ; slot = (slot + 1) & slotMask)
+		{
+			if(slots[slot] == 0)
+			{
+				slots[slot] = position + 1;
+				return;
+			}
+			if(memcmp(names[slots[slot] - 1].bytes, names[position].bytes, MAX_ENTRY_NAME) == 0)
+			{
+				return;
+			}
+		}
+	}
+
+	// rehash(): Resizes the hash table so it stays at most half full, and reinserts every entry.
+	void rehash(const uint64_t numSlots)
+	{
+		slots.assign(numSlots, 0);
+		slotMask = numSlots - 1;
+		for(uint32_t i = 0; i < (uint32_t)names.size(); i++)
+		{
+			insert(i);
+		}
+	}
+
+public:
+	// Construct
+	KdbIndex()
+	{
+		slotMask = 0;
+	}
+	KdbIndex(const unsigned char* kdbBuffer, const uint64_t bufferLen)
+	{
+		slotMask = 0;
+		build(kdbBuffer, bufferLen);
+	}
+
+	// build(): Indexes the entry list of a kdb file in one pass, replacing any previous index.
+	// The walk stops at bufferLen, so an unterminated list ends at the last whole entry.
+	// Params:	unsigned char*; buffer holding the kdb file
+	//			uint64_t; length of the buffer
+	void build(const unsigned char* kdbBuffer, const uint64_t bufferLen)
+	{
+		names.clear();
+		blockListPos.clear();
+		rehash(64);
+		if(bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+		{
+			return;
+		}
+
+		for(uint64_t entryIndex = readOffset(kdbBuffer, NUM_MAGIC_BYTES); entryIndex + ENTRY_SIZE <= bufferLen && readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+		{
+			const char* entryName = (const char*)&kdbBuffer[entryIndex];
+			KdbName newName;
+			makeKey(entryName, strnlen(entryName, MAX_ENTRY_NAME), newName);
+			names.push_back(newName);
+			blockListPos.push_back(readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME));
+
+			if(names.size() * 2 > slots.size())
+			{
+				rehash(slots.size() * 2);
+			}
+			else
+			{
+				insert((uint32_t)names.size() - 1);
+			}
+		}
+	}
+
+	// find(): Looks up an entry by name, without allocating.
+	// Params:	char*; entry name (need not be null terminated)
+	//			size_t; length of the name
+	// Return:	int64_t; entry list position of the first entry with that name, -1 if not found.
+	int64_t find(const char* name, const size_t length) const
+	{
+		KdbName key;
+		if(slots.empty() == true || makeKey(name, length, key) == false)
+		{
+			return -1;
+		}
+
+		for(uint64_t slot = hashName(key) & slotMask; slots[slot] != 0; slot = (slot + 1) & slotMask)
+		{
+			if(memcmp(names[slots[slot] - 1].bytes, key.bytes, MAX_ENTRY_NAME) == 0)
+			{
+				return (int64_t)slots[slot] - 1;
+			}
+		}
+
+		return -1;
+	}
+	int64_t find(const string &name) const { return find(name.data(), name.size()); }
+
+	// Getters
+	size_t getNumEntries() const { return names.size(); }
+	const char* getName(const size_t position) const { return names[position].bytes; } // not terminated for 16 character names
+	uint32_t getBlockListPos(const size_t position) const { return blockListPos[position]; }
+};
+
+/***********************/
+/******* Reader ********/
+// KdbReader: Zero-copy kdb reader. The kdb file is memory mapped and the entry and block lists are
+// walked in place on open, recording only each entry's name, block list and size. Entry data is
+// gathered and decrypted only when asked for, straight into the caller's buffer. Entry names are
+// indexed with a KdbIndex for findEntry(). Offsets are read unsigned, so stores up to 4 GiB can be addressed.
+class KdbReader {
+private:
+	MappedFile file;
+	vector<EntryInfo> entries;
+	KdbIndex index;
+
+	// readLists(): Walks the entry list and each block list of the mapped file. Walks stop at the end of
+	// the file as readBlockViews() does, so entry sizes match what readEntry() and openStream() yield.
+	void readLists()
+	{
+		const unsigned char* kdbBuffer = file.getData();
+		const uint64_t bufferLen = file.getSize();
+		if(bufferLen < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+		{
+			return;
+		}
+
+		// Read entry list, walking each block list for entry size
+		vector<BlockView> views; // reused for every entry
+		for(uint64_t entryIndex = readOffset(kdbBuffer, NUM_MAGIC_BYTES); entryIndex + ENTRY_SIZE <= bufferLen && readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+		{
+			EntryInfo newEntry;
+			newEntry.name = (const char*)&kdbBuffer[entryIndex];
+			newEntry.blockListPos = readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME);
+			newEntry.size = readBlockViews(kdbBuffer, bufferLen, newEntry.blockListPos, views, newEntry.numBlocks);
+			entries.push_back(newEntry);
+		}
+		index.build(kdbBuffer, bufferLen);
+	}
+
+	// clearLists(): Forgets the entries and name index of the previous file, so nothing points into its mapping.
+	void clearLists()
+	{
+		entries.clear();
+		index = KdbIndex();
+	}
+
+public:
+	// Construct
+	KdbReader() {}
+	KdbReader(const string kdbFileName) { open(kdbFileName); }
+
+	// open(): Maps a kdb file and walks its entry and block lists.
+	// Params:	string; name or path of kdb file
+	// Return:	bool; flag for if the file was opened. False if missing or unreadable.
+	bool open(const string kdbFileName)
+	{
+		clearLists();
+		if(file.open(kdbFileName, ACCESS_RANDOM) == false)
+		{
+			return false;
+		}
+		readLists();
+
+		return true;
+	}
+
+	// open(): Maps a kdb file from an untrusted source, validating it (see validateKDB()) before walking its lists.
+	// Params:	string; name or path of kdb file
+	//			(OUT) KdbError; result of validation
+	// Return:	bool; flag for if the file was opened. False if missing or unreadable (error code KDB_OK), or malformed.
+	bool open(const string kdbFileName, KdbError &error)
+	{
+		clearLists();
+		if(file.open(kdbFileName, ACCESS_RANDOM) == false)
+		{
+			error.code = KDB_OK;
+			error.position = 0;
+			error.entry = -1;
+			return false;
+		}
+		error = validateKDB(file.getData(), file.getSize());
+		if(error.code != KDB_OK)
+		{
+			file.close();
+			return false;
+		}
+		readLists();
+
+		return true;
+	}
+
+	// findEntry(): Finds an entry by name.
+	// Params:	string; entry name
+	// Return:	int64_t; index of the first entry with that name, -1 if not found.
+	int64_t findEntry(const string &name) const
+	{
+		return index.find(name);
+	}
+
+	// readEntry(): Gathers and decrypts an entry's data into a caller buffer.
+	// Params:	size_t; entry index
+	//			unsigned char*; destination, at least getEntry(index).size bytes
+	// Return:	uint64_t; number of bytes written
+	uint64_t readEntry(const size_t index, unsigned char* data) const
+	{
+		vector<BlockView> views;
+		readBlockViews(file.getData(), file.getSize(), entries[index].blockListPos, views);
+		uint64_t readCount = gatherBlockViews(views, data);
+		decryptEntryData(data, readCount, 1);
+		return readCount;
+	}
+
+	// openStream(): Chunked reader over an entry's decrypted data, see EntryStream.
+	// Params:	size_t; entry index
+	// Return:	EntryStream; stream positioned at the start of the entry
+	EntryStream openStream(const size_t index) const
+	{
+		return EntryStream(file.getData(), file.getSize(), entries[index].blockListPos);
+	}
+
+	// Getters
+	size_t getNumEntries() const { return entries.size(); }
+	const EntryInfo& getEntry(const size_t index) const { return entries[index]; }
+	string getEntryName(const size_t index) const { return string(entries[index].name, strnlen(entries[index].name, MAX_ENTRY_NAME)); }
+	const MappedFile& getFile() const { return file; }
+	const KdbIndex& getIndex() const { return index; }
+};
+
 #endif
@@ -1,6 +1,6 @@
 // David Ramsey
 // Last updated 01/31/2021
-// Dependencies: parseKDB.h lsfr.h md5.h
+// Dependencies: parseKDB.h carveJPEG.h multiMD5.h contentSet.h lsfr.h md5.h
 // Non-std Libraries: md5.cpp/.h used for md5 hash function, source: http://www.zedwood.com/article/cpp-md5-function
 // REFERENCES:
 // - For opending a binary file properly, and getting file length, Reference: http://www.cplusplus.com/reference/istream/istream/read/
@@ -8,251 +8,221 @@
 // - md5 hash function, Source: http://www.zedwood.com/article/cpp-md5-function
 // - Create a directory (Windows), Reference: https://docs.microsoft.com/en-us/windows/win32/fileio/retrieving-and-changing-file-attributes
 // - Create a directory (Linux/Unix), References: https://linux.die.net/man/3/mkdir, https://pubs.opengroup.org/onlinepubs/7908799/xsh/sysstat.h.html
+// KDB SIGNATURES:
+// - By default the jpeg signature is the entry named exactly MAGIC, and carved jpegs are repaired to JPEG_START.
+// - With --signatures every entry named MAGIC<x> (e.g. MAGIC, MAGIC2, MAGICPNG) is a signature, all carved in one pass.
+//   Repair bytes for MAGIC<x> are read from the entry named REPAIR<x> if present, otherwise JPEG_START is used.
 
 #include <iostream>
 #include <fstream>
 #include <stdio.h>
 #include <iomanip>
+#include <thread>
+#include <cerrno>
 #include <sys/types.h>
 #include <sys/stat.h>
 
 #include "parseKDB.h"
+#include "carveJPEG.h"
+#include "multiMD5.h"
+#include "contentSet.h"
 #include "md5.h"     // MD5 hash library, Provided by: http://www.zedwood.com/article/cpp-md5-function
 
 using namespace std;
 
 /***********************/
 /****** Constants ******/
-const unsigned char JPEG_START[] = {0xFF, 0xD8, 0xFF}; // Starting indicator bytes of a jpeg file
-const unsigned char JPEG_TERMINATOR[] = {0xFF, 0xD9}; // Terminating bytes of a jpeg file
-const int32_t JPEG_START_SIZE = 3;                    // Number of jpeg indicating bytes
-const int32_t JPEG_TERMINATOR_SIZE = 2;               // Number of jpeg terminating bytes
+const char SIGNATURE_PREFIX[] = "MAGIC";	// Kdb entry holding the jpeg signature, or with --signatures the prefix of each
+const char REPAIR_PREFIX[] = "REPAIR";		// With --signatures, repair bytes for signature MAGIC<x> are held in entry REPAIR<x>
+const char USAGE[] = "Usage: driver.exe <kdb file> <input file> [threads] [--stream] [--markers] [--max-size=<bytes>] [--dedup] [--signatures]";
 
 /***********************/
 /******* Classes *******/
+// Jpeg: View of one carved jpeg within the mapped input, no copy of its bytes is made. The repaired
+// first bytes are read from the signature's repair bytes in place of the input's, and the rest from the
+// input. The input mapping and signatures must outlive the view. Move-only, so lists of views are never
+// copied by accident.
 class Jpeg {
 private:
-	unsigned char* data;	// Jpeg data
-	int32_t size;			// Length of data
-	int32_t offset;			// Offset within input file
-	string hash;			// md5 hash of jpeg data
-	string outPath;			// Relative output path for writing jpeg data
+	const unsigned char* input;		// Mapped input the jpeg lies in
+	const unsigned char* repair;	// Repair bytes read in place of the jpeg's first bytes
+	size_t repairSize;				// Number of repaired bytes (repair bytes, at most the jpeg size)
+	uint64_t size;					// Length of the jpeg
+	uint64_t offset;				// Offset within input file
+	string hash;					// md5 hash of repaired jpeg data
+	string outPath;					// Relative output path for writing jpeg data
 
 public:
-	// Construct and Destruct
+	// Construct
 	Jpeg()
 	{
+		input = NULL;
+		repair = NULL;
+		repairSize = 0;
 		size = 0;
 		offset = 0;
 		hash = " ";
 		outPath = " ";
-		data = NULL;
 	}
-	~Jpeg()
+	Jpeg(const unsigned char* newInput, const JpegSpan &span, const vector<unsigned char> &newRepair)
 	{
-		if(data != NULL)
-		{
-			delete [] data;
-			data = NULL;
-		}
+		input = newInput;
+		repair = newRepair.data();
+		repairSize = (newRepair.size() < span.size) ? newRepair.size() : (size_t)span.size;
+		size = span.size;
+		offset = span.offset;
+		hash = " ";
+		outPath = " ";
 	}
+	Jpeg(Jpeg &&other) = default;
+	Jpeg& operator=(Jpeg &&other) = default;
+	Jpeg(const Jpeg&) = delete;
+	Jpeg& operator=(const Jpeg&) = delete;
 	
 	// Misc
 	void print()
 	{
-		cout << setw(10) << getOffset() << setw(10) << getSize() << setw(40) << getHash() << setw(40) << getOutPath(); // Reference: https://www.cplusplus.com/reference/iomanip/
+		cout << setw(10) << getOffset() << setw(10) << getSize() << setw(40) << getHash() << " " << setw(39) << getOutPath(); // Reference: https://www.cplusplus.com/reference/iomanip/
+	}
+
+	// getHashJob(): md5 job hashing the repaired jpeg, the repaired bytes then the input tail in place.
+	Md5Job getHashJob() const
+	{
+		return Md5Job(getHead(), getHeadSize(), getTail(), getTailSize());
+	}
+
+	// write(): Writes the repaired jpeg, repaired bytes then the input tail in place.
+	void write(ostream &outStream) const
+	{
+		outStream.write((const char*)getHead(), getHeadSize());
+		outStream.write((const char*)getTail(), getTailSize());
 	}
-	
 	
 	// Setters and Getters
 	void setOutPath(string newOutPath) { outPath = newOutPath; }
 	void setHash(string newHash) { hash = newHash; }
-	void setOffset(int32_t newOffset) { offset = newOffset; }
-	void setSize(int32_t newSize) { size = newSize; }
-	void setData(unsigned char* newData, int32_t newSize) 
-	{ 
-		data = newData; 
-		size = newSize;
-	}
-	unsigned char* getData() { return data; }
-	int32_t getOffset() { return offset; }
-	int32_t getSize() { return size; }
-	string getHash() { return hash; }
-	string getOutPath() { return outPath; }
+	const unsigned char* getHead() const { return repair; }
+	size_t getHeadSize() const { return repairSize; }
+	const unsigned char* getTail() const { return input + offset + repairSize; }
+	uint64_t getTailSize() const { return size - repairSize; }
+	uint64_t getOffset() const { return offset; }
+	uint64_t getSize() const { return size; }
+	string getHash() const { return hash; }
+	string getOutPath() const { return outPath; }
 };
 
 /***********************/
-/******* Utility *******/
-// readFileToBuffer(): Reads a binary file into a byte array.
-// Ignores passed value of buffer argument, and size argument.
-// Params:  string; name of binary file
-//          (OUT) unsigned char*; buffer holding binary file data
-//          (OUT) int32_t; size of the buffer/binary file data
-void readFileToBuffer(const string fileName, unsigned char* &buffer, int32_t &size)
-{
-	ifstream fileStream;
-	fileStream.open(fileName, ifstream::binary | ifstream::in); // read as binary, Reference: http://www.cplusplus.com/reference/istream/istream/read/
-	
-	// Get length of file, Reference: http://www.cplusplus.com/reference/istream/istream/read/
-	fileStream.seekg(0, fileStream.end);
-	size = fileStream.tellg();
-	fileStream.seekg(0, fileStream.beg);
-
-	// Read file into buffer
-	buffer = new unsigned char[size];
-	fileStream.read((char*)buffer, size);
-	
-	fileStream.close();
-}
-
-/***********************/
-/******* Parsing *******/
-// checkMatch(): compares two byte arrays for equivalent data.
-// Size assumed to be greater than zero, and less than or equal to the length of the smallest byte array.
-// Params:  unsigned char*; first byte array for comparison.
-//          unsigned char*; second byte array for comparison.
-//          size; number of bytes to compare.
-// Return: bool; flag if arrays have matching data. True for equivalent, false for not equivalent.
-bool checkMatch(const unsigned char* source, const unsigned char* match, const int32_t size)
+/***** Procedures ******/
+// parseCount(): Parses a whole argument as a decimal count. Signs, trailing characters and values
+// too large for 64 bits are rejected, unlike a bare strtoull().
+// Params:	string; argument text
+//			(OUT) uint64_t; parsed value, set only on success
+// Return:	bool; flag for if the argument was a valid count
+bool parseCount(const string text, uint64_t &value)
 {
-	for(int i = 0; i < size; i++)
+	if(text.empty() == true || text.find_first_not_of("0123456789") != string::npos)
 	{
-		if(source[i] != match[i])
-		{
-			return false;
-		}
+		return false;
 	}
+	errno = 0;
+	unsigned long long parsed = strtoull(text.c_str(), NULL, 10);
+	if(errno == ERANGE)
+	{
+		return false;
+	}
+	value = (uint64_t)parsed;
 
 	return true;
 }
 
-/***********************/
-/***** Procedures ******/
-// readMagicBytesFromKDB(): parse kdb file for magic bytes (found within 'MAGIC' entry)
+// readSignaturesFromKDB(): parse kdb file for jpeg signatures (found within 'MAGIC' entry).
+// With allSignatures, every entry named 'MAGIC<x>' is a signature and its repair bytes are read from
+// entry 'REPAIR<x>' if present. Repair bytes are JPEG_START otherwise.
 // Params: 	string; name or path of kdb file
-//			(OUT) unsigned char*; pointer to magic bytes
-//			(OUT) int32_t; length of magic bytes (i.e. number of magic bytes)
-void readMagicBytesFromKDB(const string kdbFileName, unsigned char* &magicBytes, int32_t &numMagicBytes)
+//			bool; flag for reading every MAGIC<x> entry (--signatures) rather than only the one named MAGIC
+//			(OUT) vector<Signature>; signatures found, in entry list order
+void readSignaturesFromKDB(const string kdbFileName, const bool allSignatures, vector<Signature> &signatures)
 {
-	// Read kdb file into buffer
-	int32_t kdbStreamLen = 0;
-	unsigned char* kdbBuffer = NULL;
-	readFileToBuffer(kdbFileName, kdbBuffer, kdbStreamLen);
-
-	// Parse kdb for entries
-	vector<Entry> entryList = parseKDB(kdbBuffer, kdbStreamLen);
-
-	// Search for magic bytes entry
-	bool found = false;
-	vector<Entry>::iterator entryIt = entryList.begin();
-	while(found == false && entryIt != entryList.end())
+	// Map kdb file and check it is well formed before trusting its offsets
+	MappedFile kdbFile(kdbFileName, ACCESS_RANDOM);
+	KdbError error = validateKDB(kdbFile.getData(), kdbFile.getSize());
+	if(error.code != KDB_OK)
 	{
-		if(entryIt->name == "MAGIC") // magic bytes found in entry named MAGIC
-		{
-			// Copy magic bytes into output var
-			numMagicBytes = entryIt->size;
-			magicBytes = new unsigned char[numMagicBytes];
-			memcpy(magicBytes, entryIt->data, numMagicBytes);
-			
-			// End search
-			found = true;
-		}
-		entryIt++;
+		cerr << "Malformed kdb file (" << getKdbErrorName(error.code) << " at offset " << error.position << ")" << endl;
+		return;
 	}
-	
-	// Clean entries
-	for(vector<Entry>::iterator entryIt = entryList.begin(); entryIt != entryList.end(); entryIt++)
+
+	// Read entry list, no block list or entry data is read yet
+	vector<LazyEntry> entryList = parseKDBLazy(kdbFile.getData(), kdbFile.getSize());
+
+	// Collect signature entries, decrypting only these
+	for(vector<LazyEntry>::iterator entryIt = entryList.begin(); entryIt != entryList.end(); entryIt++)
 	{
-		if(entryIt->data != NULL)
+		string name = entryIt->getName();
+		bool isSignature = (allSignatures == true) ? (name.compare(0, strlen(SIGNATURE_PREFIX), SIGNATURE_PREFIX) == 0) : (name == SIGNATURE_PREFIX);
+		if(isSignature == true && entryIt->getSize() > 0)
 		{
-			delete [] entryIt->data;
-			entryIt->data = NULL;
+			Signature newSignature;
+			newSignature.name = name;
+			newSignature.pattern.assign(entryIt->getData(), entryIt->getData() + entryIt->getSize());
+			newSignature.repair.assign(JPEG_START, JPEG_START + JPEG_START_SIZE);
+			signatures.push_back(newSignature);
+			if(allSignatures == false)
+			{
+				return; // only the first entry named MAGIC
+			}
 		}
 	}
-	
-	// Clean buffer
-	delete [] kdbBuffer;
-	kdbBuffer = NULL;
-}
 
-// readJpegsFromInput(): Reads and repairs jpeg data from input file.
-// Ignores jpegs not starting with magic bytes.
-// Params:	string; name or path of input file
-//			unsigned char*; pointer to array of magic bytes indicating jpeg file
-//			int32_t; length of magic bytes array (i.e. number of magic bytes)
-// Return:	vector<Jpeg>; vector of jpeg objects parsed from input file, with magic bytes 
-//			repaired to standard jpeg indicator bytes.
-vector<Jpeg> readJpegsFromInput(const string inputFileName, unsigned char* magicBytes, int32_t numMagicBytes)
-{
-	vector<Jpeg> jpegList;
-	
-	// Read input file to buffer
-	int inputStreamLen = 0;
-	unsigned char* inputBuffer = NULL;
-	readFileToBuffer(inputFileName, inputBuffer, inputStreamLen);
-	
-	// First pass, identify jpegs
-	int32_t i = 0;
-	while(i < inputStreamLen)
+	// Override repair bytes where given
+	for(vector<LazyEntry>::iterator entryIt = entryList.begin(); entryIt != entryList.end(); entryIt++)
 	{
-		// If jpeg found
-		if(checkMatch(&inputBuffer[i], magicBytes, numMagicBytes) == true)
+		string name = entryIt->getName();
+		if(name.compare(0, strlen(REPAIR_PREFIX), REPAIR_PREFIX) == 0 && entryIt->getSize() > 0)
 		{
-			Jpeg newJpeg;
-			newJpeg.setOffset(i); // save offset
-		
-			// Find end of jpeg and calculate size
-			i += numMagicBytes; // skip magic bytes
-			while(checkMatch(&inputBuffer[i], JPEG_TERMINATOR, JPEG_TERMINATOR_SIZE) == false)
+			string signatureName = SIGNATURE_PREFIX + name.substr(strlen(REPAIR_PREFIX));
+			for(size_t sig = 0; sig < signatures.size(); sig++)
 			{
-				i++;
+				if(signatures[sig].name == signatureName)
+				{
+					signatures[sig].repair.assign(entryIt->getData(), entryIt->getData() + entryIt->getSize());
+				}
 			}
-			int32_t size = (i + JPEG_TERMINATOR_SIZE) - newJpeg.getOffset(); // accounts for length of terminator
-
-			// Save jpeg info to list
-			newJpeg.setSize(size);
-			jpegList.push_back(newJpeg);
-
-			// Move to end of terminator
-			i += JPEG_TERMINATOR_SIZE - 1;
-		}
-		else
-		{
-			i++;
 		}
 	}
+}
 
-	// Second pass, read and repair jpegs
-	unsigned char* data = NULL;
-	for(vector<Jpeg>::iterator jpegIt = jpegList.begin(); jpegIt != jpegList.end(); jpegIt++)
-	{
-		// Read jpeg data
-		data = new unsigned char[jpegIt->getSize()];
-		memcpy(data, &inputBuffer[jpegIt->getOffset()], jpegIt->getSize());
-		
-		// Repair obfuscated starting bytes
-		memcpy(data, JPEG_START, JPEG_START_SIZE);
+// readJpegsFromInput(): Finds jpegs within the mapped input file.
+// Ignores jpegs not starting with a signature.
+// Params:	MappedFile; input file, must outlive the jpegs
+//			SignatureMatcher; compiled signatures indicating jpeg files, must outlive the jpegs
+//			unsigned int; number of threads carving the input
+//			CarveOptions; how jpeg ends are found, and the size cutoff
+// Return:	vector<Jpeg>; views of the jpegs found in the input, with signatures
+//			repaired to their repair bytes.
+vector<Jpeg> readJpegsFromInput(const MappedFile &inputFile, const SignatureMatcher &matcher, const unsigned int numThreads, const CarveOptions &options)
+{
+	// Identify jpegs of every signature at once
+	vector<JpegSpan> spans;
+	carveSignaturesParallel(inputFile.getData(), inputFile.getSize(), matcher, spans, numThreads, CARVE_CHUNK_SIZE, options);
 
-		// Save data
-		jpegIt->setData(data, jpegIt->getSize());
-		data = NULL;
+	// View each in place, repair bytes overlaying its start
+	vector<Jpeg> jpegList;
+	jpegList.reserve(spans.size());
+	for(size_t j = 0; j < spans.size(); j++)
+	{
+		jpegList.emplace_back(inputFile.getData(), spans[j], matcher.getSignature(spans[j].signature).repair);
 	}
-	
-	// Clean
-	delete [] inputBuffer;
-	inputBuffer = NULL;
-	
+
 	return jpegList;
 }
 
-// outputJpegs(): prints jpeg metadata and writes jpegs to output directory.
-// Output directory is created if one does not exist.
+// createOutputDir(): Creates the output directory for an input file, if one does not exist.
 // Not fully tested on linux.
-// Params:	vector<Jpeg>; list of repaired jpegs to output
-//			string; name of input file the jpegs were recieved from
-void outputJpegs(vector<Jpeg> &jpegList, const string inputFileName)
-{	
-	// Create output directory
+// Params:	string; name of input file the jpegs are recieved from
+// Return:	string; relative path of the output directory
+string createOutputDir(const string inputFileName)
+{
 	string outputDir = inputFileName + "_Repaired";
 	#if defined(WIN32) || defined(_WIN32) || defined(__WIN32__)
 		// Create directory (Windows), Reference: https://docs.microsoft.com/en-us/windows/win32/fileio/retrieving-and-changing-file-attributes
@@ -262,9 +232,27 @@ void outputJpegs(vector<Jpeg> &jpegList, const string inputFileName)
 		// Create directory (Linux/Unix), References: https://linux.die.net/man/3/mkdir, https://pubs.opengroup.org/onlinepubs/7908799/xsh/sysstat.h.html
 		mkdir(outputDir.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
 	#endif
-	
+
+	return outputDir;
+}
+
+// printTableHeader(): prints the column titles of the jpeg table.
+void printTableHeader()
+{
 	cout << endl << endl << setw(10) << "Offset" << setw(10) << "Size" << setw(40) << "Hash" << setw(40) << "Out Path" << endl; // Reference: https://www.cplusplus.com/reference/iomanip/
 	cout << string(100, '-') << endl;
+}
+
+// outputJpegs(): prints jpeg metadata and writes jpegs to output directory.
+// Output directory is created if one does not exist.
+// Params:	vector<Jpeg>; list of repaired jpegs to output
+//			string; name of input file the jpegs were recieved from
+void outputJpegs(vector<Jpeg> &jpegList, const string inputFileName)
+{	
+	// Create output directory
+	string outputDir = createOutputDir(inputFileName);
+	
+	printTableHeader();
 	// Write jpegs to output directory, and print their info
 	for(vector<Jpeg>::iterator jpegIt = jpegList.begin(); jpegIt != jpegList.end(); jpegIt++)
 	{
@@ -275,7 +263,7 @@ void outputJpegs(vector<Jpeg> &jpegList, const string inputFileName)
 		// Write jpeg to outpath
 		ofstream jpegStream;
 		jpegStream.open(outPath, ostream::binary | ostream::trunc);
-		jpegStream.write((char*)jpegIt->getData(), jpegIt->getSize());
+		jpegIt->write(jpegStream);
 		jpegStream.close();
 		
 		// Print jpeg info
@@ -286,41 +274,239 @@ void outputJpegs(vector<Jpeg> &jpegList, const string inputFileName)
 	cout << endl;
 }
 
+// outputUniqueJpegs(): Hashes jpegs, prints their metadata and writes each distinct jpeg once to the output
+// directory, named by its md5 hash. Jpegs are grouped by md5 digest and size while hashing, and every
+// jpeg is printed with the out path of its content.
+// Output directory is created if one does not exist.
+// Params:	vector<Jpeg>; list of repaired jpegs to output
+//			string; name of input file the jpegs were recieved from
+//			unsigned int; number of threads hashing jpegs
+void outputUniqueJpegs(vector<Jpeg> &jpegList, const string inputFileName, const unsigned int numThreads)
+{
+	// Hash and group jpegs by content
+	vector<Md5Job> hashJobs;
+	hashJobs.reserve(jpegList.size());
+	for(vector<Jpeg>::iterator jpegIt = jpegList.begin(); jpegIt != jpegList.end(); jpegIt++)
+	{
+		hashJobs.push_back(jpegIt->getHashJob());
+	}
+	ContentSet contentSet;
+	groupMd5Jobs(hashJobs, numThreads, contentSet);
+	vector<ContentGroup> groups = contentSet.getGroups();
+
+	// Create output directory
+	string outputDir = createOutputDir(inputFileName);
+
+	// Write each content once, from its first jpeg
+	for(vector<ContentGroup>::iterator groupIt = groups.begin(); groupIt != groups.end(); groupIt++)
+	{
+		string hash = md5HexDigest(groupIt->digest);
+		string outPath = outputDir + "/" + hash + ".jpeg"; // relative path
+		for(size_t m = 0; m < groupIt->members.size(); m++)
+		{
+			jpegList[groupIt->members[m]].setHash(hash);
+			jpegList[groupIt->members[m]].setOutPath(outPath);
+		}
+
+		ofstream jpegStream;
+		jpegStream.open(outPath, ostream::binary | ostream::trunc);
+		jpegList[groupIt->members[0]].write(jpegStream);
+		jpegStream.close();
+	}
+
+	// Print every jpeg's info, duplicates sharing an out path
+	printTableHeader();
+	for(vector<Jpeg>::iterator jpegIt = jpegList.begin(); jpegIt != jpegList.end(); jpegIt++)
+	{
+		jpegIt->print();
+		cout << endl;
+	}
+	cout << endl << jpegList.size() << " jpegs, " << groups.size() << " unique written" << endl << endl;
+}
+
+// streamJpegsFromInput(): Reads, repairs, hashes and writes jpegs while the input is read through a fixed
+// window (see streamCarve()), so memory use does not grow with the input or jpeg sizes. Prints the same
+// table as outputJpegs(), each jpeg's row as soon as its terminator is read.
+// Params:	string; name or path of input file
+//			SignatureMatcher; compiled signatures indicating jpeg files
+// Return:	bool; flag for if the input file was opened
+bool streamJpegsFromInput(const string inputFileName, const SignatureMatcher &matcher)
+{
+	ifstream inputStream(inputFileName, ifstream::binary | ifstream::in);
+	if(inputStream.is_open() == false)
+	{
+		cerr << "Input file " << inputFileName << " not found. Quitting..." << endl;
+		return false;
+	}
+	string outputDir = createOutputDir(inputFileName);
+	printTableHeader();
+
+	// Jpeg being carved
+	ofstream jpegStream;
+	MD5 hash;
+	string outPath;
+	uint64_t offset = 0;
+	uint64_t written = 0;
+	const vector<unsigned char>* repair = NULL;
+
+	JpegHandlers handlers;
+	handlers.begin = [&](uint64_t jpegOffset, uint32_t signature) {
+		offset = jpegOffset;
+		written = 0;
+		repair = &matcher.getSignature(signature).repair;
+		outPath = outputDir + "/" + to_string(offset) + ".jpeg"; // relative path
+		jpegStream.open(outPath, ostream::binary | ostream::trunc);
+		hash = MD5();
+	};
+	handlers.data = [&](const unsigned char* data, size_t length) {
+		// Repair obfuscated starting bytes as they pass
+		if(written < repair->size())
+		{
+			size_t repaired = (repair->size() - written < length) ? (size_t)(repair->size() - written) : length;
+			jpegStream.write((const char*)repair->data() + written, repaired);
+			hash.update(repair->data() + written, (MD5::size_type)repaired);
+			data += repaired;
+			length -= repaired;
+			written += repaired;
+		}
+		jpegStream.write((const char*)data, length);
+		hash.update(data, (MD5::size_type)length);
+		written += length;
+	};
+	handlers.end = [&](uint64_t size) {
+		jpegStream.close();
+		hash.finalize();
+		cout << setw(10) << offset << setw(10) << size << setw(40) << hash.hexdigest() << setw(40) << outPath << endl;
+	};
+	handlers.discard = [&]() {
+		jpegStream.close();
+		remove(outPath.c_str());
+	};
+	streamCarve(inputStream, matcher, handlers);
+
+	cout << endl;
+	return true;
+}
+
 /***********************/
 /********* Main ********/
 int main(int argc, char* argv[])
 {
-	// Parse kdb for magic bytes
+	if(argc < 3)
+	{
+		cerr << USAGE << endl;
+		return 1;
+	}
+
+	// Optional arguments: number of carving threads, --stream to carve through a fixed window,
+	// --markers to end jpegs by walking their markers, --max-size=<bytes> to skip longer jpegs,
+	// --dedup to write each distinct jpeg once, and --signatures to carve for every MAGIC<x> entry.
+	// Anything else is a usage error.
 	string kdbFileName = argv[1];
-	unsigned char* magicBytes = NULL;
-	int32_t numMagicBytes = 0;
-	readMagicBytesFromKDB(kdbFileName, magicBytes, numMagicBytes);
+	string inputFileName = argv[2];
+	unsigned int numThreads = thread::hardware_concurrency();
+	bool streaming = false;
+	bool dedup = false;
+	bool allSignatures = false;
+	CarveOptions options;
+	for(int arg = 3; arg < argc; arg++)
+	{
+		string option = argv[arg];
+		if(option == "--stream")
+		{
+			streaming = true;
+		}
+		else if(option == "--dedup")
+		{
+			dedup = true;
+		}
+		else if(option == "--signatures")
+		{
+			allSignatures = true;
+		}
+		else if(option == "--markers")
+		{
+			options.end = END_BY_MARKERS;
+		}
+		else if(option.compare(0, 11, "--max-size=") == 0)
+		{
+			if(parseCount(option.substr(11), options.maxSize) == false)
+			{
+				cerr << "Invalid size in " << option << endl << USAGE << endl;
+				return 1;
+			}
+		}
+		else
+		{
+			uint64_t count = 0;
+			if(parseCount(option, count) == false)
+			{
+				cerr << "Unknown option " << option << endl << USAGE << endl;
+				return 1;
+			}
+			if(count == 0 || count > UINT32_MAX)
+			{
+				cerr << "Invalid thread count " << option << endl << USAGE << endl;
+				return 1;
+			}
+			numThreads = (unsigned int)count;
+		}
+	}
+
+	// Parse kdb for signatures
+	vector<Signature> signatures;
+	readSignaturesFromKDB(kdbFileName, allSignatures, signatures);
 
 	// Check for missing entry
-	if(magicBytes == NULL || numMagicBytes == 0)
+	if(signatures.empty() == true)
 	{
 		cerr << "Magic bytes not found. Quitting..." << endl;
 		exit(0);
 	}
+	SignatureMatcher matcher(signatures);
 
-	// Retrieve obfuscated jpegs
-	string inputFileName = argv[2];
-	vector<Jpeg> jpegList = readJpegsFromInput(inputFileName, magicBytes, numMagicBytes);
+	if(streaming == true)
+	{
+		if(options.end != END_AT_TERMINATOR || options.maxSize != 0)
+		{
+			cerr << "Streamed carving ends jpegs at their terminator, ignoring --markers and --max-size" << endl;
+		}
+		if(dedup == true)
+		{
+			cerr << "Streamed carving writes jpegs as they are read, ignoring --dedup" << endl;
+		}
+		return (streamJpegsFromInput(inputFileName, matcher) == true) ? 0 : 1;
+	}
+
+	// Retrieve obfuscated jpegs, viewed in the mapped input
+	MappedFile inputFile(inputFileName, ACCESS_SEQUENTIAL);
+	if(inputFile.isOpen() == false)
+	{
+		cerr << "Input file " << inputFileName << " not found. Quitting..." << endl;
+		return 1;
+	}
+	vector<Jpeg> jpegList = readJpegsFromInput(inputFile, matcher, numThreads, options);
+	if(dedup == true)
+	{
+		outputUniqueJpegs(jpegList, inputFileName, numThreads);
+		return 0;
+	}
 
-	// Calculate hash
+	// Calculate hashes, jpegs hashed side by side in simd lanes across threads
+	vector<Md5Job> hashJobs;
+	hashJobs.reserve(jpegList.size());
 	for(vector<Jpeg>::iterator jpegIt = jpegList.begin(); jpegIt != jpegList.end(); jpegIt++)
 	{
-		string data((char*)jpegIt->getData(), jpegIt->getSize());
-		string hash = md5(data); // md5 library source: http://www.zedwood.com/article/cpp-md5-function
-		jpegIt->setHash(hash);
+		hashJobs.push_back(jpegIt->getHashJob());
+	}
+	hashMd5Jobs(hashJobs, numThreads);
+	for(size_t j = 0; j < jpegList.size(); j++)
+	{
+		jpegList[j].setHash(md5HexDigest(hashJobs[j].digest));
 	}
 
 	// Output jpegs
 	outputJpegs(jpegList, inputFileName);
 
-	// Clean
-	delete [] magicBytes;
-	magicBytes = NULL;
-
 	return 0;
 }
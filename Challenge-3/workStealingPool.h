@@ -0,0 +1,111 @@
+// David Ramsey
+// Last updated 01/31/2021
+// REFERENCES: None, only provided materials used.
+
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/***********************/
+/******* Classes *******/
+// WorkStealingPool: Runs a batch of independent tasks across threads. Each worker owns a queue, added
+// tasks are dealt out round-robin, and a worker whose queue runs dry steals from the front of the
+// others' queues. Tasks must not add further tasks while the batch runs.
+class WorkStealingPool {
+private:
+	struct WorkQueue {
+		mutex lock;
+		deque< function<void()> > tasks;
+	};
+
+	vector< unique_ptr<WorkQueue> > queues;	// One queue per worker
+	size_t nextQueue;						// Queue receiving the next added task
+
+	// takeTask(): Pops from a worker's own queue (newest first), or steals from another queue (oldest first).
+	bool takeTask(const size_t worker, function<void()> &task)
+	{
+		{
+			lock_guard<mutex> guard(queues[worker]->lock);
+			if(queues[worker]->tasks.empty() == false)
+			{
+				task = std::move(queues[worker]->tasks.back());
+				queues[worker]->tasks.pop_back();
+				return true;
+			}
+		}
+		for(size_t i = 1; i < queues.size(); i++)
+		{
+			WorkQueue &victim = *queues[(worker + i) % queues.size()];
+			lock_guard<mutex> guard(victim.lock);
+			if(victim.tasks.empty() == false)
+			{
+				task = std::move(victim.tasks.front());
+				victim.tasks.pop_front();
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	// work(): Worker loop, runs tasks until every queue is empty.
+	void work(const size_t worker)
+	{
+		function<void()> task;
+		while(takeTask(worker, task) == true)
+		{
+			task();
+		}
+	}
+
+public:
+	// Construct
+	WorkStealingPool(unsigned int numThreads)
+	{
+		if(numThreads == 0)
+		{
+			numThreads = 1;
+		}
+		for(unsigned int i = 0; i < numThreads; i++)
+		{
+			queues.push_back(unique_ptr<WorkQueue>(new WorkQueue()));
+		}
+		nextQueue = 0;
+	}
+
+	// add(): Queues a task for the next run().
+	void add(function<void()> task)
+	{
+		lock_guard<mutex> guard(queues[nextQueue]->lock);
+		queues[nextQueue]->tasks.push_back(std::move(task));
+		nextQueue = (nextQueue + 1) % queues.size();
+	}
+
+	// run(): Runs every queued task and returns once all have finished. The calling thread is one of the workers.
+	void run()
+	{
+		vector<thread> workers;
+		for(size_t i = 1; i < queues.size(); i++)
+		{
+			workers.push_back(thread(&WorkStealingPool::work, this, i));
+		}
+		work(0);
+		for(size_t i = 0; i < workers.size(); i++)
+		{
+			workers[i].join();
+		}
+	}
+
+	// Getters
+	size_t getNumThreads() const { return queues.size(); }
+};
+
+#endif
@@ -0,0 +1,439 @@
+// David Ramsey
+// Last updated 01/31/2021
+// Dependencies: parseKDB.h lsfr.h keystreamCache.h mappedFile.h workStealingPool.h
+// REFERENCES:
+// - For opending a binary file properly, Reference: http://www.cplusplus.com/reference/ostream/ostream/write/
+// - Reading and writing one file stream, Reference: http://www.cplusplus.com/reference/fstream/fstream/
+
+#ifndef WRITEKDB_H
+#define WRITEKDB_H
+
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <string>
+#include <cstring>
+#include <stdint.h>
+#include <vector>
+
+#include "parseKDB.h"
+
+using namespace std;
+
+/***********************/
+/****** Constants ******/
+const uint64_t MAX_BLOCK_DATA = 32767;			// Most data bytes in one block (block sizes are int16_t)
+const uint64_t MAX_KDB_OFFSET = 0xFFFFFFFE;		// Last position a 32 bit kdb offset can hold (0xFFFFFFFF is the terminator)
+const unsigned char APPEND_FOOTER_TAG[] = {'K', 'D', 'B', 'A'};	// Tag ending the footer left by appendKDB()
+const uint64_t APPEND_FOOTER_SIZE = 12;			// Footer length (terminator position, end of spare entry slots, tag)
+const uint64_t APPEND_MIN_SLOTS = 64;			// Fewest entry slots reserved when appendKDB() moves the entry list
+const char COMPACT_TEMP_SUFFIX[] = ".tmp";		// Suffix of the file compactKDB() writes before renaming it into place
+
+/***********************/
+/*** Helper Functions **/
+// writeLittleEndian(): Appends an integer to a stream in little endian order.
+// Templated for integer types, undefined behavior for non-integer types.
+// Params:	ostream; stream written to
+//			class type (intended to be integer type); value to write
+template<class T>
+void writeLittleEndian(ostream &stream, const T value)
+{
+	for(int i = 0; i < (int)sizeof(T); i++)
+	{
+		stream.put((char)((value >> (i * BYTE)) & 0xFF));
+	}
+}
+
+// pushLittleEndian(): Appends an integer to a byte vector in little endian order.
+template<class T>
+void pushLittleEndian(vector<unsigned char> &buffer, const T value)
+{
+	for(int i = 0; i < (int)sizeof(T); i++)
+	{
+		buffer.push_back((unsigned char)((value >> (i * BYTE)) & 0xFF));
+	}
+}
+
+// pushBlockRun(): Appends block list records covering a contiguous run of data, as few blocks as block sizes allow.
+// Params:	vector<unsigned char>; block list being built
+//			uint64_t; file position of the run
+//			uint64_t; length of the run
+void pushBlockRun(vector<unsigned char> &blockList, uint64_t position, uint64_t size)
+{
+	while(size > 0)
+	{
+		uint64_t length = (size < MAX_BLOCK_DATA) ? size : MAX_BLOCK_DATA;
+		pushLittleEndian<int16_t>(blockList, (int16_t)length);
+		pushLittleEndian<uint32_t>(blockList, (uint32_t)position);
+		position += length;
+		size -= length;
+	}
+}
+
+// writeEncrypted(): Encrypts entry data with DECRYPT_KEY and writes it to a stream, a chunk at a time
+// with the key carried across chunks.
+// Params:	ostream; stream written to, at the entry's data position
+//			unsigned char*; plain entry data
+//			uint64_t; length of entry data
+//			vector<unsigned char>; scratch buffer for encrypted chunks
+void writeEncrypted(ostream &stream, const unsigned char* data, const uint64_t size, vector<unsigned char> &chunk)
+{
+	chunk.resize(STREAM_CHUNK_SIZE);
+	unsigned int key = getNewKey(DECRYPT_KEY);
+	for(uint64_t pos = 0; pos < size; pos += STREAM_CHUNK_SIZE)
+	{
+		size_t length = (size - pos < STREAM_CHUNK_SIZE) ? (size_t)(size - pos) : STREAM_CHUNK_SIZE;
+		key = CryptFromKey(data + pos, chunk.data(), length, key);
+		stream.write((const char*)chunk.data(), length);
+	}
+}
+
+/***********************/
+/******* Classes *******/
+// KdbWriter: Writes a kdb file front to back. Each entry's data is written as one contiguous run,
+// in the order entries are added, split into as few blocks as block sizes allow. Block lists and the
+// entry list are held in memory (6 bytes per block, 20 per entry) and written after all data on close().
+// Layout: header, entry data, block lists, entry list.
+class KdbWriter {
+private:
+	ofstream kdbStream;
+	vector<unsigned char> blockLists;		// Block list of every entry, positions relative to the block list region
+	vector<unsigned char> entryList;		// Entry list, block list positions relative to the block list region
+	vector<unsigned char> chunk;			// Buffer for encrypting entry data
+	bool failed;							// Flag for if a write failed or an offset overflowed
+
+	// beginEntry(): Checks an entry name and room for size more data bytes. Returns position of the entry's block list.
+	bool beginEntry(const char* name, const size_t nameLength, const uint64_t size, uint64_t &blockListPos)
+	{
+		if(failed == true || kdbStream.is_open() == false || nameLength > (size_t)MAX_ENTRY_NAME
+			|| (uint64_t)kdbStream.tellp() + size > MAX_KDB_OFFSET)
+		{
+			failed = true;
+			return false;
+		}
+
+		char entryName[MAX_ENTRY_NAME] = {0};
+		memcpy(entryName, name, nameLength);
+		blockListPos = blockLists.size();
+		entryList.insert(entryList.end(), entryName, entryName + MAX_ENTRY_NAME);
+		pushLittleEndian<uint32_t>(entryList, (uint32_t)blockListPos);
+		return true;
+	}
+
+	// endEntry(): Terminates the block list of the entry just added.
+	void endEntry()
+	{
+		pushLittleEndian<uint32_t>(blockLists, (uint32_t)LIST_TERMINATOR);
+		failed = failed || kdbStream.fail();
+	}
+
+public:
+	// Construct and Destruct
+	KdbWriter()
+	{
+		failed = false;
+	}
+	KdbWriter(const string fileName, const unsigned char* magicBytes)
+	{
+		failed = false;
+		open(fileName, magicBytes);
+	}
+	~KdbWriter()
+	{
+		close();
+	}
+
+	// open(): Creates (or truncates) a kdb file and writes its header.
+	// Params:	string; name or path of kdb file
+	//			unsigned char*; NUM_MAGIC_BYTES magic bytes for the header
+	// Return:	bool; flag for if the file was created
+	bool open(const string fileName, const unsigned char* magicBytes)
+	{
+		close();
+		blockLists.clear();
+		entryList.clear();
+		failed = false;
+
+		kdbStream.open(fileName, ofstream::binary | ofstream::out | ofstream::trunc);
+		if(kdbStream.is_open() == false)
+		{
+			return false;
+		}
+		kdbStream.write((const char*)magicBytes, NUM_MAGIC_BYTES);
+		writeLittleEndian<uint32_t>(kdbStream, 0); // entry list position, filled in by close()
+		return true;
+	}
+
+	// addEntry(): Encrypts entry data with DECRYPT_KEY and writes it as one contiguous run.
+	// Params:	string; entry name (at most MAX_ENTRY_NAME characters, not terminated if exactly that long)
+	//			unsigned char*; plain entry data
+	//			uint64_t; length of entry data
+	// Return:	bool; flag for if the entry was added. False if the name is too long or the file would pass 4 GiB.
+	bool addEntry(const string name, const unsigned char* data, const uint64_t size)
+	{
+		uint64_t blockListPos = 0;
+		if(beginEntry(name.data(), name.size(), size, blockListPos) == false)
+		{
+			return false;
+		}
+
+		pushBlockRun(blockLists, (uint64_t)kdbStream.tellp(), size);
+		writeEncrypted(kdbStream, data, size, chunk);
+
+		endEntry();
+		return (failed == false);
+	}
+
+	// addEncryptedEntry(): Writes already encrypted entry data (e.g. the blocks of another kdb file) as one contiguous run.
+	// Params:	char*; entry name (at most MAX_ENTRY_NAME bytes, need not be null terminated)
+	//			vector<BlockView>; encrypted data, in entry order
+	// Return:	bool; flag for if the entry was added. False if the name is too long or the file would pass 4 GiB.
+	bool addEncryptedEntry(const char* name, const vector<BlockView> &views)
+	{
+		uint64_t size = 0;
+		for(size_t v = 0; v < views.size(); v++)
+		{
+			size += views[v].size;
+		}
+		uint64_t blockListPos = 0;
+		if(beginEntry(name, strnlen(name, MAX_ENTRY_NAME), size, blockListPos) == false)
+		{
+			return false;
+		}
+
+		pushBlockRun(blockLists, (uint64_t)kdbStream.tellp(), size);
+		for(size_t v = 0; v < views.size(); v++)
+		{
+			kdbStream.write((const char*)views[v].data, views[v].size);
+		}
+
+		endEntry();
+		return (failed == false);
+	}
+
+	// close(): Writes the block lists and entry list, then fills in the header. Does nothing if no file is open.
+	// Return:	bool; flag for if every entry was written
+	bool close()
+	{
+		if(kdbStream.is_open() == false)
+		{
+			return (failed == false);
+		}
+
+		// Block lists, then entry list with block list positions made absolute
+		uint64_t blockListsStart = (uint64_t)kdbStream.tellp();
+		uint64_t entryListPos = blockListsStart + blockLists.size();
+		if(entryListPos + entryList.size() + sizeof(uint32_t) > MAX_KDB_OFFSET)
+		{
+			failed = true;
+		}
+		kdbStream.write((const char*)blockLists.data(), blockLists.size());
+		for(size_t e = 0; e < entryList.size(); e += ENTRY_SIZE)
+		{
+			uint32_t blockListPos = readOffset(entryList.data(), e + MAX_ENTRY_NAME) + (uint32_t)blockListsStart;
+			kdbStream.write((const char*)&entryList[e], MAX_ENTRY_NAME);
+			writeLittleEndian<uint32_t>(kdbStream, blockListPos);
+		}
+		writeLittleEndian<uint32_t>(kdbStream, (uint32_t)LIST_TERMINATOR);
+
+		kdbStream.seekp(NUM_MAGIC_BYTES);
+		writeLittleEndian<uint32_t>(kdbStream, (uint32_t)entryListPos);
+		failed = failed || kdbStream.fail();
+		kdbStream.close();
+
+		blockLists.clear();
+		entryList.clear();
+		return (failed == false);
+	}
+};
+
+/***********************/
+/****** Functions ******/
+// readFileOffset(): Reads an unsigned 32 bit little endian offset from a position of a file stream.
+uint32_t readFileOffset(fstream &stream, const uint64_t pos)
+{
+	unsigned char buffer[sizeof(uint32_t)] = {0};
+	stream.seekg(pos);
+	stream.read((char*)buffer, sizeof(uint32_t));
+	return readOffset(buffer, 0);
+}
+
+// appendKDB(): Adds one entry to an existing kdb file without rewriting it.
+// The entry's data (encrypted with DECRYPT_KEY) and block list are written at the end of the file.
+// The entry list is then extended in place, into spare slots reserved after its terminator. When there
+// are none, the entry list is copied to the end of the file with room to double, and the header pointed
+// at it. A footer after the spare slots records where they are, and is overwritten by the next append.
+// Apart from those copies, which are amortized over the appends that fill the slots, the cost is proportional
+// to the new entry. The entry is linked in last, so the file stays readable if an append is interrupted.
+// Params:	string; name or path of kdb file
+//			string; entry name (at most MAX_ENTRY_NAME characters, not terminated if exactly that long)
+//			unsigned char*; plain entry data
+//			uint64_t; length of entry data
+// Return:	bool; flag for if the entry was added. False if the file is missing or not a kdb file,
+//			the name is too long, or the file would pass 4 GiB.
+bool appendKDB(const string fileName, const string name, const unsigned char* data, const uint64_t size)
+{
+	if(name.size() > (size_t)MAX_ENTRY_NAME)
+	{
+		return false;
+	}
+	fstream kdbStream(fileName, fstream::binary | fstream::in | fstream::out);
+	if(kdbStream.is_open() == false)
+	{
+		return false;
+	}
+	kdbStream.seekg(0, kdbStream.end);
+	uint64_t fileSize = (uint64_t)kdbStream.tellg();
+	if(fileSize < (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t))
+	{
+		return false;
+	}
+	uint64_t entryListPos = readFileOffset(kdbStream, NUM_MAGIC_BYTES);
+
+	// Find spare entry slots from the footer of a previous append
+	uint64_t listEnd = 0;
+	uint64_t slotsEnd = 0;
+	uint64_t writePos = fileSize;
+	bool haveSlots = false;
+	if(fileSize >= (uint64_t)NUM_MAGIC_BYTES + sizeof(uint32_t) + APPEND_FOOTER_SIZE)
+	{
+		unsigned char footer[APPEND_FOOTER_SIZE];
+		kdbStream.seekg(fileSize - APPEND_FOOTER_SIZE);
+		kdbStream.read((char*)footer, APPEND_FOOTER_SIZE);
+		listEnd = readOffset(footer, 0);
+		slotsEnd = readOffset(footer, sizeof(uint32_t));
+		haveSlots = (memcmp(footer + 2 * sizeof(uint32_t), APPEND_FOOTER_TAG, sizeof(APPEND_FOOTER_TAG)) == 0
+			&& listEnd >= entryListPos && (listEnd - entryListPos) % ENTRY_SIZE == 0
+			&& listEnd + sizeof(uint32_t) <= slotsEnd && slotsEnd <= fileSize - APPEND_FOOTER_SIZE
+			&& readFileOffset(kdbStream, listEnd) == (uint32_t)LIST_TERMINATOR);
+		if(haveSlots == true)
+		{
+			writePos = fileSize - APPEND_FOOTER_SIZE;
+		}
+	}
+	bool moveList = (haveSlots == false || listEnd + ENTRY_SIZE + sizeof(uint32_t) > slotsEnd);
+
+	// Block list for data written at writePos, then the new entry
+	vector<unsigned char> blockList;
+	pushBlockRun(blockList, writePos, size);
+	pushLittleEndian<uint32_t>(blockList, (uint32_t)LIST_TERMINATOR);
+	uint64_t blockListPos = writePos + size;
+	uint64_t tailPos = blockListPos + blockList.size();
+
+	vector<unsigned char> entry(MAX_ENTRY_NAME, 0);
+	memcpy(entry.data(), name.data(), name.size());
+	pushLittleEndian<uint32_t>(entry, (uint32_t)blockListPos);
+
+	// Copy of the entry list with the new entry and spare slots, only when moving it
+	vector<unsigned char> entryList;
+	if(moveList == true)
+	{
+		unsigned char oldEntry[ENTRY_SIZE];
+		for(uint64_t entryIndex = entryListPos; readFileOffset(kdbStream, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+		{
+			kdbStream.seekg(entryIndex);
+			kdbStream.read((char*)oldEntry, ENTRY_SIZE);
+			if(kdbStream.fail() == true)
+			{
+				return false;
+			}
+			entryList.insert(entryList.end(), oldEntry, oldEntry + ENTRY_SIZE);
+		}
+		uint64_t numSlots = 2 * (entryList.size() / ENTRY_SIZE + 1);
+		if(numSlots < APPEND_MIN_SLOTS)
+		{
+			numSlots = APPEND_MIN_SLOTS;
+		}
+		entryList.insert(entryList.end(), entry.begin(), entry.end());
+		listEnd = tailPos + entryList.size();
+		pushLittleEndian<uint32_t>(entryList, (uint32_t)LIST_TERMINATOR);
+		entryList.resize(numSlots * ENTRY_SIZE + sizeof(uint32_t), 0);
+		slotsEnd = tailPos + entryList.size();
+	}
+	else
+	{
+		listEnd += ENTRY_SIZE;
+	}
+	if(tailPos + entryList.size() + APPEND_FOOTER_SIZE > MAX_KDB_OFFSET)
+	{
+		return false;
+	}
+
+	// Data, block list, moved entry list and footer, all past the current entry list
+	kdbStream.seekp(writePos);
+	vector<unsigned char> chunk;
+	writeEncrypted(kdbStream, data, size, chunk);
+	kdbStream.write((const char*)blockList.data(), blockList.size());
+	kdbStream.write((const char*)entryList.data(), entryList.size());
+	writeLittleEndian<uint32_t>(kdbStream, (uint32_t)listEnd);
+	writeLittleEndian<uint32_t>(kdbStream, (uint32_t)slotsEnd);
+	kdbStream.write((const char*)APPEND_FOOTER_TAG, sizeof(APPEND_FOOTER_TAG));
+	kdbStream.flush();
+
+	// Link the entry in
+	if(moveList == true)
+	{
+		kdbStream.seekp(NUM_MAGIC_BYTES);
+		writeLittleEndian<uint32_t>(kdbStream, (uint32_t)tailPos);
+	}
+	else
+	{
+		kdbStream.seekp(listEnd);
+		writeLittleEndian<uint32_t>(kdbStream, (uint32_t)LIST_TERMINATOR);
+		kdbStream.flush();
+		kdbStream.seekp(listEnd - ENTRY_SIZE);
+		kdbStream.write((const char*)entry.data(), ENTRY_SIZE);
+	}
+	kdbStream.flush();
+
+	return (kdbStream.fail() == false);
+}
+
+// compactKDB(): Rewrites a kdb file with each entry's blocks laid out contiguously, in entry list order.
+// Data is copied still encrypted (the keystream depends only on the offset within the entry), so
+// entries read back identical. Unreferenced bytes of the source are dropped. The source is validated
+// (see validateKDB()) before the compacted file is created, so a malformed source writes nothing.
+// The file is written under a temporary name and renamed into place only once complete, so a failed
+// write (e.g. past 4 GiB) leaves no partial store behind, and any previous file at outFileName is kept.
+// Params:	unsigned char*; buffer holding the source kdb file
+//			uint64_t; length of the buffer
+//			string; name or path of the compacted kdb file
+//			(OUT) KdbError; result of validating the source
+// Return:	bool; flag for if the compacted file was written
+bool compactKDB(const unsigned char* kdbBuffer, const uint64_t bufferLen, const string outFileName, KdbError &error)
+{
+	error = validateKDB(kdbBuffer, bufferLen, false);
+	if(error.code != KDB_OK)
+	{
+		return false;
+	}
+
+	const string tempFileName = outFileName + COMPACT_TEMP_SUFFIX;
+	KdbWriter kdbWriter;
+	if(kdbWriter.open(tempFileName, kdbBuffer) == false)
+	{
+		return false;
+	}
+
+	vector<BlockView> views;
+	for(uint64_t entryIndex = readOffset(kdbBuffer, NUM_MAGIC_BYTES); readOffset(kdbBuffer, entryIndex) != (uint32_t)LIST_TERMINATOR; entryIndex += ENTRY_SIZE)
+	{
+		readBlockViews(kdbBuffer, bufferLen, readOffset(kdbBuffer, entryIndex + MAX_ENTRY_NAME), views);
+		if(kdbWriter.addEncryptedEntry((const char*)&kdbBuffer[entryIndex], views) == false)
+		{
+			kdbWriter.close();
+			remove(tempFileName.c_str());
+			return false;
+		}
+	}
+
+	if(kdbWriter.close() == false || rename(tempFileName.c_str(), outFileName.c_str()) != 0)
+	{
+		remove(tempFileName.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+#endif